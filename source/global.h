@@ -24,6 +24,9 @@
 
 #define  PROGNAME       "zita-at1"
 #define  EV_X11         16
+#define  EV_RECONF      17
+#define  EV_NSM         18
+#define  EV_PARAM       19
 #define  EV_EXIT        31
 
 
@@ -0,0 +1,105 @@
+// ----------------------------------------------------------------------------
+//
+//  Copyright (C) 2010-2024 Fons Adriaensen <fons@linuxaudio.org>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// ----------------------------------------------------------------------------
+
+
+#include "headless.h"
+#include "state.h"
+#include "nsm.h"
+
+
+extern NSM_Client *nsm;
+
+
+Headless::Headless (Jclient *jclient) :
+    A_thread ("Main"),
+    _stop (false),
+    _jclient (jclient),
+    _ccount (0),
+    _xp (100),
+    _yp (100),
+    _shown (true),
+    _dirty (false)
+{
+    set_time (0);
+    inc_time (500000);
+}
+
+
+Headless::~Headless (void)
+{
+}
+
+
+int Headless::process (void)
+{
+    int e;
+
+    if (_stop) put_event (EV_EXIT, 1);
+
+    e = get_event_timed ();
+    switch (e)
+    {
+    case EV_TIME:
+        handle_time ();
+        break;
+    }
+    return e;
+}
+
+
+void Headless::handle_time (void)
+{
+    if (_jclient->get_ccount () != _ccount)
+    {
+        // Parameters changed by MIDI CC or OSC.
+        _ccount = _jclient->get_ccount ();
+        setdirty ();
+    }
+    inc_time (50000);
+}
+
+
+void Headless::setdirty (void)
+{
+    if (!_dirty)
+    {
+        if (nsm) nsm->is_dirty ();
+        _dirty = true;
+    }
+}
+
+
+void Headless::load_state (void)
+{
+    // The window position and visibility are kept for the
+    // next save, so the file can still be used with the GUI.
+    state_load (_statefile.c_str (), _jclient, &_xp, &_yp, &_shown);
+    _dirty = false;
+    if (nsm) nsm->is_clean ();
+}
+
+
+void Headless::save_state (void)
+{
+    if (state_save (_statefile.c_str (), _jclient, _xp, _yp, _shown))
+    {
+        _dirty = false;
+        if (nsm) nsm->is_clean ();
+    }
+}
@@ -0,0 +1,69 @@
+// ----------------------------------------------------------------------------
+//
+//  Copyright (C) 2010-2024 Fons Adriaensen <fons@linuxaudio.org>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// ----------------------------------------------------------------------------
+
+
+#ifndef __HEADLESS_H
+#define __HEADLESS_H
+
+
+#include <string>
+#include <clthreads.h>
+#include "jclient.h"
+#include "global.h"
+
+
+using namespace std;
+
+
+// Replaces the Mainwin when running without a display. It
+// provides the timer for the main loop, and keeps the state
+// file and the NSM dirty flag as the Mainwin does.
+
+class Headless : public A_thread
+{
+public:
+
+    Headless (Jclient *jclient);
+    ~Headless (void);
+
+    void stop (void) { _stop = true; }
+    int process (void);
+    void load_state (void);
+    void save_state (void);
+    void set_statefile (const string s) { _statefile = s; }
+
+private:
+
+    virtual void thr_main (void) {}
+
+    void handle_time (void);
+    void setdirty (void);
+
+    bool            _stop;
+    Jclient        *_jclient;
+    unsigned int    _ccount;
+    string          _statefile;
+    int             _xp;
+    int             _yp;
+    bool            _shown;
+    bool            _dirty;
+};
+
+
+#endif
@@ -21,18 +21,83 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <math.h>
+#include <unistd.h>
 #include <jack/midiport.h>
 #include "jclient.h"
+#include "rtcheck.h"
 #include "global.h"
 
 
-Jclient::Jclient (const char *jname, const char *jserv) :
+// Range of the parameters, as for the GUI controls.
+static const float parmin [Jclient::NPARAM] = { 400.0f, 0.02f, 0.0f, 0.0f, -2.0f };
+static const float parmax [Jclient::NPARAM] = { 480.0f, 0.50f, 1.0f, 1.0f,  2.0f };
+
+
+Jchannel::Jchannel (void) :
+    _retuner (0),
+    _newret (0),
+    _oldret (0),
+    _xfbuff (0),
+    _ainp_port (0),
+    _aout_port (0),
+    _inpp (0),
+    _outp (0),
+    _pipinp (0),
+    _pipout (0),
+    _refpitch (440.0f),
+    _notebias (0.5f),
+    _corrfilt (0.1f),
+    _corrgain (1.0f),
+    _corroffs (0.0f),
+    _lowlat (false),
+    _latency (0),
+    _notemask (0xFFF),
+    _rtmask (0xFFF),
+    _phase (0.0f),
+    _mnote (-1),
+    _mbend (8192)
+{
+    for (int i = 0; i < 3; i++)
+    {
+        _actl_port [i] = 0;
+        _ctlp [i] = 0;
+        _pipctl [i] = 0;
+    }
+}
+
+
+Jchannel::~Jchannel (void)
+{
+    delete _retuner;
+    delete _oldret;
+    delete[] _xfbuff;
+    delete[] _pipinp;
+    delete[] _pipout;
+    for (int i = 0; i < 3; i++) delete[] _pipctl [i];
+}
+
+
+Jclient::Jclient (const char *jname, const char *jserv, int nchan, int nwork,
+                  bool pipe, bool simd, bool stagger, bool midiout, bool ctlout) :
     A_thread ("jclient"),
     _jack_client (0),
+    _mout_port (0),
     _active (false),
-    _jname (0)
+    _jname (0),
+    _jserv (0),
+    _nchan (nchan),
+    _chan (0),
+    _bank (0),
+    _newbank (0),
+    _oldbank (0),
+    _cclearn (-1),
+    _rcstate (RC_IDLE),
+    _timing (false),
+    _tsreq (1),
+    _xruns (0)
 {
-    init_jack (jname, jserv);
+    init_jack (jname, jserv, nwork, pipe, simd, stagger, midiout, ctlout);
 }
 
 
@@ -42,48 +107,293 @@ Jclient::~Jclient (void)
 }
 
 
-void Jclient::init_jack (const char *jname, const char *jserv)
+void Jclient::init_jack (const char *jname, const char *jserv, int nwork, bool pipe, bool simd, bool stagger,
+                         bool midiout, bool ctlout)
 {
-    jack_status_t  stat;
-    int            opts;
+    int            c, i, k;
+    float          p;
+    Jchannel      *C;
 
-    opts = JackNoStartServer;
-    if (jserv) opts |= JackServerName;
-    if ((_jack_client = jack_client_open (jname, (jack_options_t) opts, &stat, jserv)) == 0)
+    if (open_jack (jname, jserv))
     {
         fprintf (stderr, "Can't connect to JACK.\n");
         exit (1);
     }
-    jack_on_shutdown (_jack_client, jack_static_shutdown, (void *) this);
-    jack_set_process_callback (_jack_client, jack_static_process, (void *) this);
+    _jserv = jserv;
+    _fsamp = jack_get_sample_rate (_jack_client);
+    _fsize = jack_get_buffer_size (_jack_client);
+    _reqfsamp = _fsamp;
+    _reqfsize = _fsize;
+
+    if (_nchan < 1) _nchan = 1;
+    if (_nchan > MAXCHAN) _nchan = MAXCHAN;
+    _chan = new Jchannel [_nchan];
+    _jplan = false;
+    if (stagger)
+    {
+        // Spread the pitch estimates of the channels evenly
+        // over the 4-fragment analysis cycle, in whole
+        // fragments, see Retuner::set_phase (). The position
+        // of this instance in the cycle is arbitrary, so that
+        // instances started together don't all coincide.
+        p = fmod (0.618034 * getpid (), 1.0);
+        for (c = 0; c < _nchan; c++)
+        {
+            k = (_nchan < 4) ? (4 * c) / _nchan : (c & 3);
+            _chan [c]._phase = p + 0.25f * k;
+        }
+    }
+    _ctlout = ctlout;
+    register_ports (midiout);
+    for (c = 0; c < _nchan; c++)
+    {
+        C = _chan + c;
+        C->_retuner = new Retuner (_fsamp, _fsize);
+        apply_params (C, C->_retuner);
+    }
+    update_latency ();
+	
+    _midichan = -1;
+    clr_midimask ();
+    for (c = 0; c < 128; c++) _ccpar [c] = -1;
+    _ccount = 0;
+    for (i = 0; i < NSRC; i++)
+    {
+        _parqw [i] = 0;
+        _parqr [i] = 0;
+    }
+    _retqw = 0;
+    _retqr = 0;
+    _xfsize = 0;
+    _rcwait = false;
+    _anreader = false;
+    _anepoch = 0;
+    _anack = 0;
+    _frcount = 0;
+    _jrframes = 0;
+    _jrjumps = 0;
+    _jrxfade = 0;
+    memset (_costhist, 0, COSTBINS * sizeof (int));
+    memset (&_tsacc, 0, sizeof (Tsacc));
+
+    // In SIMD mode each job is a group of channels processed
+    // together by a Retbank.
+    _njobs = _nchan;
+    if (simd && (_nchan > 1))
+    {
+        _njobs = (_nchan + Retbank::NLANE - 1) / Retbank::NLANE;
+        _bank = new Retbank [_njobs];
+        for (c = 0; c < _njobs; c++) _bank [c].init (_chan [0]._retuner);
+    }
+
+    // Worker threads only make sense with several jobs,
+    // except in pipelined mode where all work is done by them.
+    _pend = false;
+    _swap = false;
+    _pipe = false;
+    _pipframes = 0;
+    if (pipe)
+    {
+        if (nwork > _njobs) nwork = _njobs;
+        if (nwork < 1) nwork = 1;
+    }
+    else if (nwork >= _njobs) nwork = _njobs - 1;
+    if (nwork > 0)
+    {
+        _workpool.start (nwork, jack_client_real_time_priority (_jack_client), work_static, this);
+    }
+    if (pipe && _workpool.nthr ())
+    {
+        for (c = 0; c < _nchan; c++)
+        {
+            C = _chan + c;
+            C->_pipinp = new float [PIPEMAX];
+            C->_pipout = new float [PIPEMAX];
+            if (ctlout)
+            {
+                for (i = 0; i < 3; i++) C->_pipctl [i] = new float [PIPEMAX];
+            }
+        }
+        _pipe = true;
+    }
+
+    // Everything the process callback uses exists now.
+    // Run it once on silence before going live.
+    prewarm ();
+    _active.store (true, std::memory_order_release);
     if (jack_activate (_jack_client))
     {
         fprintf(stderr, "Can't activate JACK.\n");
         exit (1);
     }
+}
+
+
+int Jclient::open_jack (const char *jname, const char *jserv)
+{
+    jack_status_t  stat;
+    int            opts;
 
+    opts = JackNoStartServer;
+    if (jserv) opts |= JackServerName;
+    if ((_jack_client = jack_client_open (jname, (jack_options_t) opts, &stat, jserv)) == 0) return 1;
+    jack_on_shutdown (_jack_client, jack_static_shutdown, (void *) this);
+    jack_set_process_callback (_jack_client, jack_static_process, (void *) this);
+    jack_set_buffer_size_callback (_jack_client, jack_static_bufsize, (void *) this);
+    jack_set_sample_rate_callback (_jack_client, jack_static_srate, (void *) this);
+    jack_set_latency_callback (_jack_client, jack_static_latency, (void *) this);
+    jack_set_xrun_callback (_jack_client, jack_static_xrun, (void *) this);
     _jname = jack_get_client_name (_jack_client);
-    _fsamp = jack_get_sample_rate (_jack_client);
-    _fsize = jack_get_buffer_size (_jack_client);
+    return 0;
+}
+
+
+void Jclient::register_ports (bool midiout)
+{
+    int            c, i;
+    char           s [16];
+    Jchannel      *C;
 
-    _ainp_port = jack_port_register (_jack_client, "in",  JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput,  0);
-    _aout_port = jack_port_register (_jack_client, "out", JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
+    static const char *ctlname [3] = { "freq", "error", "ratio" };
+
+    for (c = 0; c < _nchan; c++)
+    {
+        C = _chan + c;
+        // A single channel keeps the original port names.
+        if (_nchan > 1) sprintf (s, "in_%d", c + 1);
+        else strcpy (s, "in");
+        C->_ainp_port = jack_port_register (_jack_client, s, JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput,  0);
+        if (_nchan > 1) sprintf (s, "out_%d", c + 1);
+        else strcpy (s, "out");
+        C->_aout_port = jack_port_register (_jack_client, s, JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
+        if (_ctlout)
+        {
+            // Control rate outputs.
+            for (i = 0; i < 3; i++)
+            {
+                if (_nchan > 1) sprintf (s, "%s_%d", ctlname [i], c + 1);
+                else strcpy (s, ctlname [i]);
+                C->_actl_port [i] = jack_port_register (_jack_client, s, JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
+            }
+        }
+    }
     _midi_port = jack_port_register (_jack_client, "pitch", JACK_DEFAULT_MIDI_TYPE, JackPortIsInput, 0);
-	
-    _retuner = new Retuner (_fsamp);
-    _notemask = 0xFFF;
-    _midichan = -1;
-    clr_midimask ();
+    if (midiout)
+    {
+        _mout_port = jack_port_register (_jack_client, "pitch_out", JACK_DEFAULT_MIDI_TYPE, JackPortIsOutput, 0);
+    }
+}
+
+
+int Jclient::rename (const char *jname)
+{
+    int    r;
+    char  *s;
+
+    // Reopens the JACK client under a new name, for an NSM
+    // session switch. The Retuners, buffers and worker threads
+    // are kept, only the ports are registered again. Restoring
+    // the connections is left to the session manager. If the
+    // new name can't be used the old one is tried again, if
+    // that fails as well the program terminates. Returns
+    // non-zero if the new name could not be used.
+
+    s = strdup (_jname);
+    jack_deactivate (_jack_client);
+    jack_client_close (_jack_client);
+    r = open_jack (jname, _jserv);
+    if (r)
+    {
+        fprintf (stderr, "Can't reopen JACK client as '%s'.\n", jname);
+        if (open_jack (s, _jserv))
+        {
+            free (s);
+            send_event (EV_EXIT, 1);
+            return 1;
+        }
+    }
+    free (s);
+    register_ports (_mout_port != 0);
+
+    // The server may have changed as well.
+    _reqfsamp = jack_get_sample_rate (_jack_client);
+    _reqfsize = jack_get_buffer_size (_jack_client);
+    if ((_reqfsamp != _fsamp) || (_reqfsize != _fsize)) send_event (EV_RECONF, 1);
+
+    if (jack_activate (_jack_client))
+    {
+        fprintf (stderr, "Can't activate JACK.\n");
+        send_event (EV_EXIT, 1);
+        return 1;
+    }
+    return r;
+}
+
+
+void Jclient::prewarm (void)
+{
+    int       c, i, n;
+    float     *z, *t;
+    Jchannel  *C;
+
+    // Process 200 ms of silence, enough to pass through the
+    // whole input buffer and make a few pitch estimates. This
+    // touches all memory used by the Retuners and the FFT
+    // plans, so the first real periods run at the normal cost.
 
-    _active = true;
+    z = new float [_fsize];
+    t = new float [_fsize];
+    memset (z, 0, _fsize * sizeof (float));
+    for (c = 0, C = _chan; c < _nchan; c++, C++)
+    {
+        C->_inpp = z;
+        C->_outp = t;
+        for (i = 0; i < 3; i++) C->_ctlp [i] = t;
+    }
+    _nframes = _fsize;
+    _pend = false;
+    _swap = false;
+    _nseg = 1;
+    _segfr [0] = 0;
+    _segfr [1] = _fsize;
+    _segmask [0] = 0;
+    _segcc [0] = _segcc [1] = 0;
+    _nccev = 0;
+    for (n = (_fsamp / 5 + _fsize - 1) / _fsize; n > 0; n--)
+    {
+        if (_workpool.nthr ()) _workpool.run (_njobs);
+        else
+        {
+            for (c = 0; c < _njobs; c++) job_process (c);
+        }
+    }
+    for (c = 0, C = _chan; c < _nchan; c++, C++)
+    {
+        C->_retuner->clr_anevents ();
+        C->_inpp = 0;
+        C->_outp = 0;
+        for (i = 0; i < 3; i++) C->_ctlp [i] = 0;
+    }
+    delete[] z;
+    delete[] t;
 }
 
 
 void Jclient::close_jack ()
 {
+    int c;
+
     jack_deactivate (_jack_client);
     jack_client_close (_jack_client);
-    delete _retuner;
+    _workpool.stop ();
+    if ((_rcstate.load () == RC_PEND) || (_rcstate.load () == RC_CANCEL))
+    {
+        for (c = 0; c < _nchan; c++) delete _chan [c]._newret;
+        delete[] _newbank;
+    }
+    delete[] _chan;
+    delete[] _bank;
+    delete[] _oldbank;
 }
 
 
@@ -99,12 +409,472 @@ int Jclient::jack_static_process (jack_nframes_t nframes, void *arg)
 }
 
 
+int Jclient::jack_static_bufsize (jack_nframes_t nframes, void *arg)
+{
+    ((Jclient *) arg)->jack_bufsize (nframes);
+    return 0;
+}
+
+
+int Jclient::jack_static_srate (jack_nframes_t fsamp, void *arg)
+{
+    ((Jclient *) arg)->jack_srate (fsamp);
+    return 0;
+}
+
+
+void Jclient::jack_static_latency (jack_latency_callback_mode_t mode, void *arg)
+{
+    ((Jclient *) arg)->jack_latency (mode);
+}
+
+
+int Jclient::jack_static_xrun (void *arg)
+{
+    ((Jclient *) arg)->_xruns++;
+    return 0;
+}
+
+
+void Jclient::work_static (void *arg, int job)
+{
+    Rtscope  S;
+
+    ((Jclient *) arg)->job_process (job);
+}
+
+
 void Jclient::jack_shutdown (void)
 {
     send_event (EV_EXIT, 1);
 }
 
 
+void Jclient::jack_latency (jack_latency_callback_mode_t mode)
+{
+    int                   c;
+    unsigned int          d;
+    jack_latency_range_t  R;
+    Jchannel              *C;
+
+    // The Retuner delay, and in pipelined mode the
+    // output is one more period late.
+    for (c = 0, C = _chan; c < _nchan; c++, C++)
+    {
+        d = C->_latency + (_pipe ? _fsize : 0);
+        if (mode == JackCaptureLatency)
+        {
+            jack_port_get_latency_range (C->_ainp_port, mode, &R);
+            R.min += d;
+            R.max += d;
+            jack_port_set_latency_range (C->_aout_port, mode, &R);
+        }
+        else
+        {
+            jack_port_get_latency_range (C->_aout_port, mode, &R);
+            R.min += d;
+            R.max += d;
+            jack_port_set_latency_range (C->_ainp_port, mode, &R);
+        }
+    }
+}
+
+
+// Period size and sample rate changes are only recorded
+// here, the work is done by reconfig () in the main thread.
+// The current Retuners accept any number of frames, so they
+// can continue until the replacements are ready.
+
+void Jclient::jack_bufsize (int nframes)
+{
+    _reqfsize = nframes;
+    send_event (EV_RECONF, 1);
+}
+
+
+void Jclient::jack_srate (int fsamp)
+{
+    _reqfsamp = fsamp;
+    send_event (EV_RECONF, 1);
+}
+
+
+// The parameter setters are used by the main thread. They
+// keep the values in the Jchannel for the getters and for
+// new Retuners, and pass them to the process thread which
+// applies them at the start of the next period.
+
+void Jclient::set_refpitch (int c, float v)
+{
+    set_param (SRC_MAIN, c, P_TUNE, v);
+}
+
+
+void Jclient::set_notebias (int c, float v)
+{
+    set_param (SRC_MAIN, c, P_BIAS, v);
+}
+
+
+void Jclient::set_corrfilt (int c, float v)
+{
+    set_param (SRC_MAIN, c, P_FILT, v);
+}
+
+
+void Jclient::set_corrgain (int c, float v)
+{
+    set_param (SRC_MAIN, c, P_CORR, v);
+}
+
+
+void Jclient::set_corroffs (int c, float v)
+{
+    set_param (SRC_MAIN, c, P_OFFS, v);
+}
+
+
+void Jclient::set_lowlat (int c, bool s)
+{
+    set_param (SRC_MAIN, c, P_LLAT, s ? 1.0f : 0.0f);
+}
+
+
+void Jclient::set_notemask (int c, int m)
+{
+    set_param (SRC_MAIN, c, P_MASK, m);
+}
+
+
+void Jclient::set_param (int src, int c, int par, float v)
+{
+    // Parameter 'par' of channel 'c' from thread 'src'. The
+    // continuous ones are limited to the range of the GUI
+    // controls. Only the main thread updates the Jchannel
+    // copy here, changes from other threads come back to it
+    // from the process thread, see param_update ().
+
+    if (par < NPARAM)
+    {
+        if (v < parmin [par]) v = parmin [par];
+        if (v > parmax [par]) v = parmax [par];
+    }
+    else if (par == P_LLAT) v = (v != 0) ? 1.0f : 0.0f;
+    else if (par == P_MASK) v = (int) v & 0xFFF;
+    else return;
+    param_push (src, c, par, v);
+    if (src == SRC_MAIN)
+    {
+        param_copy (c, par, v);
+        if (par == P_LLAT) update_latency ();
+    }
+    // The main thread may be waiting without a timer.
+    else send_event (EV_PARAM, 1);
+}
+
+
+void Jclient::param_copy (int c, int par, float v)
+{
+    int       c1;
+    Jchannel  *C;
+
+    // Update the Jchannel copy of a parameter, for channel
+    // 'c' or for all if negative. Main thread only.
+
+    if (c < 0)
+    {
+        c = 0;
+        c1 = _nchan;
+    }
+    else c1 = c + 1;
+    for (C = _chan + c; c < c1; c++, C++)
+    {
+        switch (par)
+        {
+        case P_TUNE: C->_refpitch = v; break;
+        case P_FILT: C->_corrfilt = v; break;
+        case P_BIAS: C->_notebias = v; break;
+        case P_CORR: C->_corrgain = v; break;
+        case P_OFFS: C->_corroffs = v; break;
+        case P_LLAT: C->_lowlat = v != 0; break;
+        case P_MASK: C->_notemask = (int) v; break;
+        }
+    }
+}
+
+
+void Jclient::param_push (int src, int c, int par, float v)
+{
+    unsigned int  w;
+    Ccevent       *E;
+
+    // Single producer, single consumer queue from thread
+    // 'src' to the process thread. It can only be full if
+    // the process callback is not running, then the change
+    // is dropped.
+
+    w = _parqw [src].load (std::memory_order_relaxed);
+    if (w - _parqr [src].load (std::memory_order_acquire) == PARQLEN) return;
+    E = _parq [src] + (w & (PARQLEN - 1));
+    E->chan = c;
+    E->par = par;
+    E->val = v;
+    _parqw [src].store (w + 1, std::memory_order_release);
+}
+
+
+void Jclient::param_drain (void)
+{
+    int           i;
+    unsigned int  r, w;
+
+    // Called by the process thread at the start of a period.
+    // Queued changes become events at frame 0. Any that don't
+    // fit are left for the next period.
+
+    for (i = 0; i < NSRC; i++)
+    {
+        r = _parqr [i].load (std::memory_order_relaxed);
+        w = _parqw [i].load (std::memory_order_acquire);
+        while ((r != w) && (_nccev < MAXCCEV))
+        {
+            _ccev [_nccev] = _parq [i][r & (PARQLEN - 1)];
+            if (i != SRC_MAIN) param_return (_ccev + _nccev);
+            _nccev++;
+            r++;
+        }
+        _parqr [i].store (r, std::memory_order_release);
+    }
+}
+
+
+void Jclient::param_return (const Ccevent *E)
+{
+    unsigned int  w;
+
+    // Process thread only. Changes not made by the main
+    // thread are sent back to it, so it can update the
+    // Jchannel copy. If the queue is full the change is
+    // only lost for display and saving.
+
+    w = _retqw.load (std::memory_order_relaxed);
+    if (w - _retqr.load (std::memory_order_acquire) == PARQLEN) return;
+    _retq [w & (PARQLEN - 1)] = *E;
+    _retqw.store (w + 1, std::memory_order_release);
+}
+
+
+void Jclient::param_update (void)
+{
+    unsigned int  r, w;
+    bool          k;
+    Ccevent       *E;
+
+    // Main thread. Applies the changes returned by the
+    // process thread to the Jchannel copies, and counts
+    // them so the GUI can show them.
+
+    k = false;
+    r = _retqr.load (std::memory_order_relaxed);
+    w = _retqw.load (std::memory_order_acquire);
+    while (r != w)
+    {
+        E = _retq + (r & (PARQLEN - 1));
+        param_copy (E->chan, E->par, E->val);
+        if (E->par == P_LLAT) k = true;
+        _ccount++;
+        r++;
+    }
+    _retqr.store (r, std::memory_order_release);
+    if (k) update_latency ();
+}
+
+
+void Jclient::update_latency (void)
+{
+    int       c;
+    bool      k;
+    Jchannel  *C;
+
+    // Called from the main thread when the delay of any
+    // Retuner may have changed. JACK is asked to call the
+    // latency callback again if it did.
+
+    k = false;
+    for (c = 0, C = _chan; c < _nchan; c++, C++)
+    {
+        if (C->_latency != C->_retuner->get_latency (C->_lowlat))
+        {
+            C->_latency = C->_retuner->get_latency (C->_lowlat);
+            k = true;
+        }
+    }
+    if (k) jack_recompute_total_latencies (_jack_client);
+}
+
+
+void Jclient::set_jumpplan (bool s)
+{
+    int       c;
+    Jchannel  *C;
+
+    _jplan = s;
+    for (c = 0, C = _chan; c < _nchan; c++, C++)
+    {
+        C->_retuner->set_jumpplan (s);
+        if (C->_newret) C->_newret->set_jumpplan (s);
+    }
+}
+
+
+void Jclient::set_timing (bool s)
+{
+    int       c;
+    Jchannel  *C;
+
+    _timing = s;
+    for (c = 0, C = _chan; c < _nchan; c++, C++)
+    {
+        C->_retuner->set_timing (s);
+        if (C->_newret) C->_newret->set_timing (s);
+    }
+}
+
+
+void Jclient::apply_params (Jchannel *C, Retuner *R)
+{
+    R->set_refpitch (C->_refpitch);
+    R->set_notebias (C->_notebias);
+    R->set_corrfilt (C->_corrfilt);
+    R->set_corrgain (C->_corrgain);
+    R->set_corroffs (C->_corroffs);
+    R->set_lowlat (C->_lowlat);
+    R->set_jumpplan (_jplan);
+    R->set_timing (_timing);
+    R->set_phase (C->_phase);
+}
+
+
+void Jclient::reconfig (void)
+{
+    int       c;
+    Jchannel  *C;
+
+    // Called from the main thread on EV_RECONF and on each
+    // timer tick. Builds replacement Retuners for a changed
+    // sample rate or period size, hands them to the process
+    // thread, and deletes the old ones once they've been
+    // taken.
+
+    param_update ();
+    switch (_rcstate.load ())
+    {
+    case RC_PEND:
+        return;
+
+    case RC_CANCEL:
+        // Never used by the process thread.
+        for (c = 0, C = _chan; c < _nchan; c++, C++)
+        {
+            delete C->_newret;
+            C->_newret = 0;
+        }
+        delete[] _newbank;
+        _newbank = 0;
+        _rcstate.store (RC_IDLE);
+        break;
+
+    case RC_DONE:
+        // The process thread now uses the new Retuners. A
+        // registered reader may still be using an old one,
+        // wait until it has seen the new epoch.
+        if (! _rcwait)
+        {
+            _anepoch++;
+            _rcwait = true;
+        }
+        if (_anreader && (_anack.load (std::memory_order_acquire) != _anepoch.load ())) return;
+        _rcwait = false;
+        for (c = 0, C = _chan; c < _nchan; c++, C++)
+        {
+            delete C->_oldret;
+            C->_oldret = 0;
+            C->_newret = 0;
+        }
+        delete[] _oldbank;
+        _oldbank = 0;
+        _newbank = 0;
+        _jrjumps = 0;
+        _jrxfade = 0;
+        _rcstate.store (RC_IDLE);
+        update_latency ();
+        break;
+    }
+
+    if ((_reqfsamp == _fsamp) && (_reqfsize == _fsize)) return;
+    _fsamp = _reqfsamp;
+    _fsize = _reqfsize;
+    if (_pipe) jack_recompute_total_latencies (_jack_client);
+    for (c = 0, C = _chan; c < _nchan; c++, C++)
+    {
+        if (_xfsize < _fsize)
+        {
+            delete[] C->_xfbuff;
+            C->_xfbuff = new float [_fsize];
+        }
+        C->_newret = new Retuner (_fsamp, _fsize);
+        apply_params (C, C->_newret);
+    }
+    if (_xfsize < _fsize) _xfsize = _fsize;
+    if (_bank)
+    {
+        // New FFT plans for the channel groups.
+        _newbank = new Retbank [_njobs];
+        for (c = 0; c < _njobs; c++) _newbank [c].init (_chan [0]._newret);
+    }
+    // Run in parallel for 100 ms, enough to fill the input
+    // buffer and make a few pitch estimates.
+    _rcdelay = _fsamp / 10;
+    _rccount = 0;
+    _rcstate.store (RC_PEND, std::memory_order_release);
+}
+
+
+void Jclient::an_register (bool on)
+{
+    if (on) an_release ();
+    _anreader.store (on);
+}
+
+
+void Jclient::get_jumprate (float *jumps, float *xfade)
+{
+    int           c;
+    unsigned int  f, j, x;
+    float         t;
+
+    // Jumps and crossfaded samples per second since
+    // the previous call, summed over all channels.
+    f = _frcount;
+    j = x = 0;
+    for (c = 0; c < _nchan; c++)
+    {
+        j += _chan [c]._retuner->get_jumpcount ();
+        x += _chan [c]._retuner->get_xfadecount ();
+    }
+    t = (f - _jrframes) / (float) _fsamp;
+    if (t > 0)
+    {
+        *jumps = (j - _jrjumps) / t;
+        *xfade = (x - _jrxfade) / t;
+    }
+    else *jumps = *xfade = 0;
+    _jrframes = f;
+    _jrjumps = j;
+    _jrxfade = x;
+}
+
+
 void Jclient::clr_midimask (void)
 {
     int i;
@@ -116,10 +886,21 @@ void Jclient::clr_midimask (void)
 
 void Jclient::midi_process (int nframes)
 {
-    int                i, b, n, t, v;
+    int                i, b, m, n, t, v;
     void               *p;
     jack_midi_event_t  E;
 
+    // The period is split into segments at the events that
+    // change the note mask, so the change takes effect at
+    // the exact frame. Without such events there is just a
+    // single segment.
+
+    _nseg = 1;
+    _segfr [0] = 0;
+    _segmask [0] = _midimask;
+    _segcc [0] = 0;
+    _nccev = 0;
+    param_drain ();
     p = jack_port_get_buffer (_midi_port, nframes);
     i = 0;
     while (jack_midi_event_get (&E, p, i) == 0)
@@ -135,32 +916,559 @@ void Jclient::midi_process (int nframes)
                 case 0x90:
                     if (v && (t & 0x10))_notes [n % 12] += 1;
                     else _notes [n % 12] -= 1;
+                    m = 0;
+                    for (n = 0, b = 1; n < 12; n++, b <<= 1) 
+                    {
+                        if (_notes [n]) m |= b;
+                    }
+                    if (m == _segmask [_nseg - 1]) break;
+                    newseg (E.time);
+                    _segmask [_nseg - 1] = m;
+                    break;
+                case 0xB0:
+                    if (n > 127) break;
+                    newseg (E.time);
+                    cc_midi (n, v);
                     break;
             }
         }
         i++;
     }
+    _segfr [_nseg] = nframes;
+    _segcc [_nseg] = _nccev;
+    _midimask = _segmask [_nseg - 1];
+}
+
+
+void Jclient::midi_output (int nframes, int nproc)
+{
+    int            c, k, t, tk;
+    int            ind [MAXCHAN];
+    void           *p;
+    const Anevent  *A;
+    Retuner        *R;
+
+    // Output the pitch estimates made while processing the
+    // last 'nproc' frames, at the same offset in the period,
+    // and merged in time order over the channels.
+
+    p = jack_port_get_buffer (_mout_port, nframes);
+    jack_midi_clear_buffer (p);
+    for (c = 0; c < _nchan; c++) ind [c] = 0;
+    while (true)
+    {
+        k = -1;
+        tk = 0;
+        for (c = 0; c < _nchan; c++)
+        {
+            R = _chan [c]._retuner;
+            while (ind [c] < R->get_nanev ())
+            {
+                // Skip estimates made in earlier periods, by
+                // a replacement Retuner before the swap.
+                t = (int)(R->get_anevent (ind [c])->time - R->get_frtotal ()) + nproc;
+                if (t >= 0) break;
+                ind [c]++;
+            }
+            if ((ind [c] < R->get_nanev ()) && ((k < 0) || (t < tk)))
+            {
+                k = c;
+                tk = t;
+            }
+        }
+        if (k < 0) break;
+        A = _chan [k]._retuner->get_anevent (ind [k]++);
+        note_output (p, (tk < nframes) ? tk : nframes - 1, k, A);
+    }
+    for (c = 0; c < _nchan; c++) _chan [c]._retuner->clr_anevents ();
+}
+
+
+void Jclient::note_output (void *p, int t, int c, const Anevent *A)
+{
+    int            n, b;
+    float          x;
+    unsigned char  *d;
+    Jchannel       *C;
+
+    // Channel 'c' uses MIDI channel c modulo 16. The nearest
+    // note, relative to the reference pitch, is sent as note
+    // on and the deviation from it as pitch bend, with a range
+    // of +/- 2 semitones.
+
+    C = _chan + c;
+    c &= 15;
+    n = -1;
+    b = 8192;
+    if (A->freq > 0)
+    {
+        x = 69 + 12 * log2f (A->freq / C->_refpitch);
+        n = (int) floorf (x + 0.5f);
+        // Out of range is handled as unvoiced, so the
+        // previous note is ended.
+        if ((n < 0) || (n > 127)) n = -1;
+        else b += (int)(4096 * (x - n));
+    }
+    if ((C->_mnote >= 0) && (n != C->_mnote))
+    {
+        if ((d = jack_midi_event_reserve (p, t, 3)))
+        {
+            d [0] = 0x80 | c;
+            d [1] = C->_mnote;
+            d [2] = 0;
+        }
+        C->_mnote = -1;
+    }
+    if (n < 0) return;
+    if (b != C->_mbend)
+    {
+        if ((d = jack_midi_event_reserve (p, t, 3)))
+        {
+            d [0] = 0xE0 | c;
+            d [1] = b & 127;
+            d [2] = b >> 7;
+        }
+        C->_mbend = b;
+    }
+    if (n != C->_mnote)
+    {
+        if ((d = jack_midi_event_reserve (p, t, 3)))
+        {
+            d [0] = 0x90 | c;
+            d [1] = n;
+            d [2] = 100;
+        }
+        C->_mnote = n;
+    }
+}
+
+
+void Jclient::newseg (int t)
+{
+    // Start a new segment at frame 't', unless that is
+    // where the current one starts or the limit is reached.
+
+    if ((t > _segfr [_nseg - 1]) && (_nseg < MAXSEG))
+    {
+        _segfr [_nseg] = t;
+        _segmask [_nseg] = _segmask [_nseg - 1];
+        _segcc [_nseg] = _nccev;
+        _nseg++;
+    }
+}
+
+
+void Jclient::cc_midi (int n, int v)
+{
+    int       k;
+    float     x;
+    Ccevent  *E;
+
+    // A controller received while in learn mode is
+    // assigned to the parameter waiting for it.
+    k = _cclearn.load ();
+    if (k >= 0)
+    {
+        _ccpar [n] = k & 255;
+        _ccchan [n] = k >> 8;
+        _cclearn.store (-1);
+    }
+    k = _ccpar [n];
+    if ((k < 0) || (_nccev == MAXCCEV)) return;
+
+    // Map the controller value to the same range and
+    // law as the corresponding GUI control.
+    x = v / 127.0f;
+    E = _ccev + _nccev++;
+    E->chan = _ccchan [n];
+    E->par = k;
+    if (k == P_FILT) E->val = parmax [k] * powf (parmin [k] / parmax [k], x);
+    else E->val = parmin [k] + x * (parmax [k] - parmin [k]);
+    param_return (E);
+}
+
+
+void Jclient::cc_apply (Jchannel *C, Retuner *R, int i0, int i1)
+{
+    int       i;
+    Ccevent  *E;
+
+    // Apply events 'i0' to 'i1', the Retuner
+    // smooths the changes.
+
+    for (i = i0, E = _ccev + i0; i < i1; i++, E++)
+    {
+        if ((E->chan >= 0) && (E->chan != C - _chan)) continue;
+        switch (E->par)
+        {
+        case P_TUNE:
+            R->set_refpitch (E->val);
+            break;
+        case P_FILT:
+            R->set_corrfilt (E->val);
+            break;
+        case P_BIAS:
+            R->set_notebias (E->val);
+            break;
+        case P_CORR:
+            R->set_corrgain (E->val);
+            break;
+        case P_OFFS:
+            R->set_corroffs (E->val);
+            break;
+        case P_LLAT:
+            R->set_lowlat (E->val != 0);
+            break;
+        case P_MASK:
+            C->_rtmask = (int) E->val & 0xFFF;
+            break;
+        }
+    }
+}
+
+
+void Jclient::set_ccmap (int cc, int par, int chan)
+{
+    if ((cc < 0) || (cc > 127)) return;
+    _ccchan [cc] = chan;
+    _ccpar [cc] = par;
+}
+
+
+int Jclient::get_ccmap (int cc, int *chan)
+{
+    *chan = _ccchan [cc];
+    return _ccpar [cc];
+}
+
+
+void Jclient::ret_process (Jchannel *C, Retuner *R, float *out)
+{
+    int  i, k, m;
+
+    // Process one period, applying the note mask
+    // and CC events of each segment.
+    for (i = 0; i < _nseg; i++)
+    {
+        k = _segfr [i];
+        m = _segmask [i];
+        if (_segcc [i + 1] > _segcc [i]) cc_apply (C, R, _segcc [i], _segcc [i + 1]);
+        R->set_notemask (m ? m : C->_rtmask);
+        R->process (_segfr [i + 1] - k, C->_inpp + k, out + k);
+    }
+}
+
+
+void Jclient::reconf_process (Jchannel *C)
+{
+    int    i;
+    float  g, d;
+
+    // The replacement Retuner runs in parallel with the current
+    // one until it has seen enough input, then the output is
+    // crossfaded to it over one period. It runs first so the
+    // input is still intact if the ports share a buffer.
+
+    if ((unsigned int) _nframes <= _xfsize) ret_process (C, C->_newret, C->_xfbuff);
+    else if (_nccev) cc_apply (C, C->_newret, 0, _nccev);
+    ret_process (C, C->_retuner, C->_outp);
+    if (! _swap) return;
+
+    d = 1.0f / _nframes;
+    for (i = 0, g = d; i < _nframes; i++, g += d)
+    {
+        C->_outp [i] += g * (C->_xfbuff [i] - C->_outp [i]);
+    }
+    C->_oldret = C->_retuner;
+    C->_retuner = C->_newret;
+}
+
+
+void Jclient::job_process (int j)
+{
+    if (_bank) bank_process (j);
+    else chan_process (j);
+}
+
+
+void Jclient::chan_process (int c)
+{
+    Jchannel *C = _chan + c;
+
+    // Called for each channel, either directly from
+    // jack_process() or from the worker threads.
+
+    if (_ctlout) C->_retuner->set_ctlout (C->_ctlp);
+    if (_pend) reconf_process (C);
+    else ret_process (C, C->_retuner, C->_outp);
+}
+
+
+void Jclient::bank_process (int b)
+{
+    int      c, i, j, k, m, n;
+    float    *inp [Retbank::NLANE];
+    float    *out [Retbank::NLANE];
+    Retuner  *R [Retbank::NLANE];
+    Jchannel *C;
+
+    c = b * Retbank::NLANE;
+    n = _nchan - c;
+    if (n > Retbank::NLANE) n = Retbank::NLANE;
 
-    _midimask = 0;
-    for (i = 0, b = 1; i < 12; i++, b <<= 1) 
+    // While replacement Retuners are pending the channels
+    // are processed one by one. The lanes are set for each
+    // period, so they follow the swap.
+
+    if (_pend)
+    {
+        for (i = 0; i < n; i++) chan_process (c + i);
+        return;
+    }
+    for (i = 0, C = _chan + c; i < n; i++, C++)
     {
-        if (_notes [i]) _midimask |= b;
+        if (_ctlout) C->_retuner->set_ctlout (C->_ctlp);
+        R [i] = C->_retuner;
+    }
+    _bank [b].set_lanes (n, R);
+    for (j = 0; j < _nseg; j++)
+    {
+        k = _segfr [j];
+        m = _segmask [j];
+        for (i = 0, C = _chan + c; i < n; i++, C++)
+        {
+            if (_segcc [j + 1] > _segcc [j]) cc_apply (C, C->_retuner, _segcc [j], _segcc [j + 1]);
+            C->_retuner->set_notemask (m ? m : C->_rtmask);
+            inp [i] = C->_inpp + k;
+            out [i] = C->_outp + k;
+        }
+        _bank [b].process (_segfr [j + 1] - k, inp, out);
     }
 }
 
 
 int Jclient::jack_process (int nframes)
 {
-    float *inpp;
-    float *outp;
+    int          c, i;
+    long long    t0;
+    Jchannel     *C;
+    Rtscope      S;
 
-    if (!_active) return 0;
+    if (! _active.load (std::memory_order_acquire)) return 0;
+
+    t0 = nsec_time ();
+    if (_pipe && (nframes <= PIPEMAX))
+    {
+        pipe_process (nframes);
+        cost_update (nframes, t0);
+        return 0;
+    }
+    // Finish any jobs left by pipelined mode.
+    _workpool.join ();
+    swap_done ();
+    _pipframes = 0;
+
+    period_init (nframes);
+    for (c = 0, C = _chan; c < _nchan; c++, C++)
+    {
+        C->_inpp = (float *) jack_port_get_buffer (C->_ainp_port, nframes);
+        C->_outp = (float *) jack_port_get_buffer (C->_aout_port, nframes);
+        if (_ctlout)
+        {
+            for (i = 0; i < 3; i++)
+            {
+                C->_ctlp [i] = (float *) jack_port_get_buffer (C->_actl_port [i], nframes);
+            }
+        }
+    }
+    if (_workpool.nthr ()) _workpool.run (_njobs);
+    else
+    {
+        for (c = 0; c < _njobs; c++) job_process (c);
+    }
+    swap_done ();
+    if (_timing) phase_collect ();
+    if (_mout_port) midi_output (nframes, nframes);
+    _frcount += nframes;
+    cost_update (nframes, t0);
 
-    inpp = (float *) jack_port_get_buffer (_ainp_port, nframes);
-    outp = (float *) jack_port_get_buffer (_aout_port, nframes);
-    midi_process (nframes);
-    _retuner->set_notemask (_midimask ? _midimask : _notemask);
-    _retuner->process (nframes, inpp, outp);
- 
     return 0;
 }
+
+
+void Jclient::cost_update (int nframes, long long t0)
+{
+    int        k;
+    long long  t;
+
+    // Histogram of the time spent in the callback, in 5%
+    // steps of the period time. The last bin counts the
+    // periods that took longer than the period time.
+
+    t = nsec_time () - t0;
+    k = (int)(t * 20e-9f * _fsamp / nframes);
+    if (k > COSTBINS - 1) k = COSTBINS - 1;
+    _costhist [k]++;
+
+    // Telemetry for get_stats ().
+    k = (int)(t * 100e-9f * _fsamp / nframes);
+    if (k > TSBINS - 1) k = TSBINS - 1;
+    _tsacc.hist [k]++;
+    if (!_tsacc.periods || (t < _tsacc.tmin)) _tsacc.tmin = t;
+    if (t > _tsacc.tmax) _tsacc.tmax = t;
+    _tsacc.tsum += t;
+    _tsacc.tper = 1000000000LL * nframes / _fsamp;
+    _tsacc.periods++;
+
+    // If the reader has asked for it, publish the data
+    // and start a new interval.
+    if (_tsreq.load (std::memory_order_acquire))
+    {
+        _tssnap = _tsacc;
+        memset (&_tsacc, 0, sizeof (Tsacc));
+        _tsreq.store (0, std::memory_order_release);
+    }
+}
+
+
+void Jclient::phase_collect (void)
+{
+    int  c;
+
+    // Called when no jobs are running.
+    for (c = 0; c < _nchan; c++) _chan [c]._retuner->get_phtime (_tsacc.phase);
+}
+
+
+bool Jclient::get_stats (Jstats *S)
+{
+    int           k;
+    unsigned int  n, m;
+    Tsacc         *T;
+
+    // Returns the data for the interval between the two
+    // latest calls, or false if the process thread has
+    // not yet taken the previous request. Must be called
+    // from a single thread.
+
+    if (_tsreq.load (std::memory_order_acquire)) return false;
+    T = &_tssnap;
+    n = T->periods;
+    S->periods = n;
+    S->xruns = _xruns.load ();
+    S->cpuload = jack_cpu_load (_jack_client);
+    S->tmin = T->tmin;
+    S->tmax = T->tmax;
+    S->tmean = n ? (float) T->tsum / n : 0.0f;
+    for (k = m = 0; k < TSBINS - 1; k++)
+    {
+        m += T->hist [k];
+        if (m >= n - n / 100) break;
+    }
+    S->tp99 = (k < TSBINS - 1) ? (k + 1) * T->tper / 100.0f : T->tmax;
+    if (S->tp99 > S->tmax) S->tp99 = S->tmax;
+    for (k = 0; k < Retuner::NPHASE; k++)
+    {
+        S->phase [k] = n ? (float) T->phase [k] / n : 0.0f;
+    }
+    get_jumprate (&S->jumps, &S->xfade);
+    _tsreq.store (1, std::memory_order_release);
+    return true;
+}
+
+
+void Jclient::get_costhist (unsigned int *hist)
+{
+    memcpy (hist, _costhist, COSTBINS * sizeof (int));
+}
+
+
+void Jclient::period_init (int nframes)
+{
+    // Set up the shared state used by chan_process().
+
+    midi_process (nframes);
+    _nframes = nframes;
+    _pend = _rcstate.load (std::memory_order_acquire) == RC_PEND;
+    _swap = false;
+    if (_pend)
+    {
+        if ((unsigned int) nframes > _xfsize)
+        {
+            // The period size has grown again before the
+            // swap, the pending Retuners can't be used. The
+            // main thread deletes them and starts anew.
+            _pend = false;
+            _rcstate.store (RC_CANCEL, std::memory_order_release);
+            return;
+        }
+        _rccount += nframes;
+        _swap = _rccount >= _rcdelay;
+    }
+}
+
+
+void Jclient::swap_done (void)
+{
+    // Tell the main thread the replacement Retuners
+    // are in use, once the jobs that swapped them
+    // are finished. The channel groups are swapped
+    // here, no job is using them.
+
+    if (_swap)
+    {
+        if (_newbank)
+        {
+            _oldbank = _bank;
+            _bank = _newbank;
+        }
+        _rcstate.store (RC_DONE, std::memory_order_release);
+        _swap = false;
+    }
+}
+
+
+void Jclient::pipe_process (int nframes)
+{
+    int       c, i, n;
+    float     *p;
+    Jchannel  *C;
+
+    // Pipelined mode. Wait for the jobs started in the previous
+    // period, output their result, and start the jobs for the
+    // current one without waiting for them. The whole period is
+    // available for processing, at the cost of one period of
+    // extra latency.
+
+    _workpool.join ();
+    swap_done ();
+    if (_timing) phase_collect ();
+
+    n = (_pipframes < nframes) ? _pipframes : nframes;
+    for (c = 0, C = _chan; c < _nchan; c++, C++)
+    {
+        p = (float *) jack_port_get_buffer (C->_aout_port, nframes);
+        memcpy (p, C->_pipout, n * sizeof (float));
+        memset (p + n, 0, (nframes - n) * sizeof (float));
+        p = (float *) jack_port_get_buffer (C->_ainp_port, nframes);
+        memcpy (C->_pipinp, p, nframes * sizeof (float));
+        C->_inpp = C->_pipinp;
+        C->_outp = C->_pipout;
+        if (_ctlout)
+        {
+            for (i = 0; i < 3; i++)
+            {
+                p = (float *) jack_port_get_buffer (C->_actl_port [i], nframes);
+                memcpy (p, C->_pipctl [i], n * sizeof (float));
+                memset (p + n, 0, (nframes - n) * sizeof (float));
+                C->_ctlp [i] = C->_pipctl [i];
+            }
+        }
+    }
+    if (_mout_port) midi_output (nframes, _pipframes);
+
+    period_init (nframes);
+    _workpool.fork (_njobs, false);
+    _pipframes = nframes;
+    _frcount += nframes;
+}
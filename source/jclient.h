@@ -22,55 +22,262 @@
 #define __JCLIENT_H
 
 
+#include <atomic>
 #include <jack/jack.h>
 #include <clthreads.h>
 #include "retuner.h"
+#include "retbank.h"
+#include "workpool.h"
+
+
+class Jchannel
+{
+public:
+
+    Jchannel (void);
+    ~Jchannel (void);
+
+    Retuner        *_retuner;
+    Retuner        *_newret;
+    Retuner        *_oldret;
+    float          *_xfbuff;
+    jack_port_t    *_ainp_port;
+    jack_port_t    *_aout_port;
+    float          *_inpp;
+    float          *_outp;
+    float          *_pipinp;
+    float          *_pipout;
+    jack_port_t    *_actl_port [3];
+    float          *_ctlp [3];
+    float          *_pipctl [3];
+    float           _refpitch;
+    float           _notebias;
+    float           _corrfilt;
+    float           _corrgain;
+    float           _corroffs;
+    bool            _lowlat;
+    int             _latency;
+    int             _notemask;
+    int             _rtmask;
+    float           _phase;
+    int             _mnote;
+    int             _mbend;
+};
 
 
 class Jclient : public A_thread
 {
 public:
 
-    Jclient (const char *jname, const char *jserv);
+    enum { MAXCHAN = 64, PIPEMAX = 8192, COSTBINS = 21 };
+
+    // Parameters for MIDI CC control, in the
+    // same order as the GUI controls, followed
+    // by the other per channel settings.
+    enum { P_TUNE, P_FILT, P_BIAS, P_CORR, P_OFFS, NPARAM, P_LLAT = NPARAM, P_MASK };
+
+    // Threads that change parameters, each has its own queue
+    // to the process thread.
+    enum { SRC_MAIN, SRC_OSC, NSRC };
+
+    // Telemetry, see get_stats (). Times are in ns. The
+    // phase times are only measured if enabled by
+    // set_timing ().
+    struct Jstats
+    {
+        unsigned int  periods;
+        unsigned int  xruns;
+        float         cpuload;
+        float         tmin;
+        float         tmean;
+        float         tp99;
+        float         tmax;
+        float         phase [Retuner::NPHASE];
+        float         jumps;
+        float         xfade;
+    };
+
+    Jclient (const char *jname, const char *jserv, int nchan = 1, int nwork = 0,
+             bool pipe = false, bool simd = false, bool stagger = false,
+             bool midiout = false, bool ctlout = false);
     ~Jclient (void);
 
     const char *jname (void) { return _jname; }
     unsigned int fsize (void) const { return _fsize; } 
     unsigned int fsamp (void) const { return _fsamp; } 
-    Retuner *retuner (void) { return _retuner; }
-    void set_notemask (int m) { _notemask = m; } 
+    int nchan (void) const { return _nchan; }
+    Retuner *retuner (int c = 0) { return _chan [c]._retuner; }
+    void set_refpitch (int c, float v);
+    void set_notebias (int c, float v);
+    void set_corrfilt (int c, float v);
+    void set_corrgain (int c, float v);
+    void set_corroffs (int c, float v);
+    void set_lowlat (int c, bool s);
+    void set_notemask (int c, int m);
+    void set_param (int src, int c, int par, float v);
+    float get_refpitch (int c) const { return _chan [c]._refpitch; }
+    float get_notebias (int c) const { return _chan [c]._notebias; }
+    float get_corrfilt (int c) const { return _chan [c]._corrfilt; }
+    float get_corrgain (int c) const { return _chan [c]._corrgain; }
+    float get_corroffs (int c) const { return _chan [c]._corroffs; }
+    bool  get_lowlat (int c) const { return _chan [c]._lowlat; }
+    int   get_notemask (int c) const { return _chan [c]._notemask; }
+    void set_jumpplan (bool s);
+    void get_jumprate (float *jumps, float *xfade);
     void set_midichan (int c) { _midichan = c; }
-    void set_lowlat (bool s) { _retuner->set_lowlat (s); }
     void clr_midimask (void);
-    int  get_noteset (void) { return _retuner->get_noteset (); }
+    bool get_anrecord (int c, unsigned int *cursor, Anrecord *R) { return _chan [c]._retuner->get_anrecord (cursor, R); }
+    // A thread other than the main one calling get_anrecord ()
+    // must register, and call an_release () whenever it is not
+    // inside that call. Retuners replaced by a reconfiguration
+    // are deleted only after it has done so.
+    void an_register (bool on);
+    void an_release (void) { _anack.store (_anepoch.load (std::memory_order_acquire), std::memory_order_release); }
     int  get_midiset (void) { return _midimask; }
+    void set_ccmap (int cc, int par, int chan);
+    int  get_ccmap (int cc, int *chan);
+    void set_cclearn (int par, int chan) { _cclearn.store ((par < 0) ? -1 : (chan << 8) | par); }
+    bool get_cclearn (void) const { return _cclearn.load () >= 0; }
+    unsigned int get_ccount (void) const { return _ccount; }
+    void get_costhist (unsigned int *hist);
+    void set_timing (bool s);
+    bool get_stats (Jstats *S);
+    void reconfig (void);
+    bool reconf_busy (void) const { return _rcstate.load () != RC_IDLE; }
+    int  rename (const char *jname);
 
 private:
 
+    enum { RC_IDLE, RC_PEND, RC_DONE, RC_CANCEL };
+    enum { MAXSEG = 64, MAXCCEV = 64, TSBINS = 201, PARQLEN = 1024 };
+
+    // Parameter change, from MIDI CC or another thread.
+    struct Ccevent
+    {
+        int    chan;
+        int    par;
+        float  val;
+    };
+
+    // Callback times, accumulated by the process thread.
+    // The histogram has 1% steps of the period time.
+    struct Tsacc
+    {
+        unsigned int  periods;
+        long long     tper;
+        long long     tsum;
+        long long     tmin;
+        long long     tmax;
+        long long     phase [Retuner::NPHASE];
+        unsigned int  hist [TSBINS];
+    };
+
     virtual void thr_main (void) {}
 
-    void init_jack (const char *jname, const char *jserv);
+    void init_jack (const char *jname, const char *jserv, int nwork, bool pipe, bool simd, bool stagger,
+                    bool midiout, bool ctlout);
+    int  open_jack (const char *jname, const char *jserv);
+    void register_ports (bool midiout);
     void close_jack (void);
+    void prewarm (void);
     void jack_shutdown (void);
     int  jack_process (int nframes);
+    void pipe_process (int nframes);
+    void period_init (int nframes);
+    void swap_done (void);
+    void jack_latency (jack_latency_callback_mode_t mode);
     void midi_process (int nframes);
+    void midi_output (int nframes, int nproc);
+    void note_output (void *p, int t, int c, const Anevent *A);
+    void job_process (int j);
+    void chan_process (int c);
+    void ret_process (Jchannel *C, Retuner *R, float *out);
+    void newseg (int t);
+    void cc_midi (int n, int v);
+    void cc_apply (Jchannel *C, Retuner *R, int i0, int i1);
+    void param_push (int src, int c, int par, float v);
+    void param_drain (void);
+    void param_return (const Ccevent *E);
+    void param_update (void);
+    void param_copy (int c, int par, float v);
+    void bank_process (int b);
+    void reconf_process (Jchannel *C);
+    void apply_params (Jchannel *C, Retuner *R);
+    void update_latency (void);
+    void jack_bufsize (int nframes);
+    void jack_srate (int fsamp);
+    void cost_update (int nframes, long long t0);
+    void phase_collect (void);
 
     jack_client_t  *_jack_client;
-    jack_port_t    *_ainp_port;
-    jack_port_t    *_aout_port;
     jack_port_t    *_midi_port;
-    bool            _active;
+    jack_port_t    *_mout_port;
+    std::atomic<bool> _active;
     const char     *_jname;
+    const char     *_jserv;
     unsigned int    _fsamp;
     unsigned int    _fsize;
-    Retuner        *_retuner;
+    int             _nchan;
+    Jchannel       *_chan;
+    Retbank        *_bank;
+    Retbank        *_newbank;
+    Retbank        *_oldbank;
+    Workpool        _workpool;
+    int             _njobs;
+    int             _nframes;
+    bool            _pend;
+    bool            _swap;
+    bool            _pipe;
+    bool            _ctlout;
+    int             _pipframes;
     int             _notes [12];
-    int             _notemask;
     int             _midimask;
     int             _midichan;
+    int             _nseg;
+    int             _segfr [MAXSEG + 1];
+    int             _segmask [MAXSEG];
+    int             _segcc [MAXSEG + 1];
+    int             _nccev;
+    Ccevent         _ccev [MAXCCEV];
+    int             _ccpar [128];
+    int             _ccchan [128];
+    std::atomic<int> _cclearn;
+    unsigned int    _ccount;
+    Ccevent         _parq [NSRC][PARQLEN];
+    std::atomic<unsigned int> _parqw [NSRC];
+    std::atomic<unsigned int> _parqr [NSRC];
+    Ccevent         _retq [PARQLEN];
+    std::atomic<unsigned int> _retqw;
+    std::atomic<unsigned int> _retqr;
+    bool            _jplan;
+    unsigned int    _xfsize;
+    unsigned int    _rccount;
+    unsigned int    _rcdelay;
+    unsigned int    _reqfsamp;
+    unsigned int    _reqfsize;
+    std::atomic<int> _rcstate;
+    bool            _rcwait;
+    std::atomic<bool> _anreader;
+    std::atomic<unsigned int> _anepoch;
+    std::atomic<unsigned int> _anack;
+    unsigned int    _frcount;
+    unsigned int    _jrframes;
+    unsigned int    _jrjumps;
+    unsigned int    _jrxfade;
+    unsigned int    _costhist [COSTBINS];
+    bool            _timing;
+    Tsacc           _tsacc;
+    Tsacc           _tssnap;
+    std::atomic<int> _tsreq;
+    std::atomic<unsigned int> _xruns;
 
     static void jack_static_shutdown (void *arg);
     static int  jack_static_process (jack_nframes_t nframes, void *arg);
+    static int  jack_static_bufsize (jack_nframes_t nframes, void *arg);
+    static int  jack_static_srate (jack_nframes_t fsamp, void *arg);
+    static void jack_static_latency (jack_latency_callback_mode_t mode, void *arg);
+    static int  jack_static_xrun (void *arg);
+    static void work_static (void *arg, int job);
 };
 
 
@@ -17,42 +17,47 @@
 //
 // ----------------------------------------------------------------------------
 
-#include <fstream>
-#include <iostream>
 #include <stdlib.h>
 #include <stdio.h>
+#include <ctype.h>
+#include <string.h>
 #include <math.h>
 #include "styles.h"
 #include "global.h"
 #include "mainwin.h"
 #include "nsm.h"
+#include "state.h"
 
 
 extern NSM_Client *nsm;
 
 Mainwin::Mainwin (X_rootwin *parent, X_resman *xres, int xp, int yp, Jclient *jclient) :
     A_thread ("Main"),
-    X_window (parent, xp, yp, XSIZE, YSIZE, XftColors [C_MAIN_BG]->pixel),
+    X_window (parent, xp, yp, XSIZE + ((jclient->nchan () > 1) ? XCHAN : 0), YSIZE, XftColors [C_MAIN_BG]->pixel),
     _stop (false),
     _ambis (false),
     _xres (xres),
     _jclient (jclient),
     _dirty (false),
-    _managed (false)
+    _managed (false),
+    _shown (false),
+    _timed (true),
+    _telem (false)
 {
     X_hints     H;
-    char        s [256];
     int         i, j, x, y;
 
+    _xsize = XSIZE;
+    if (jclient->nchan () > 1) _xsize += XCHAN;
+
     _atom = XInternAtom (dpy (), "WM_DELETE_WINDOW", True);
     XSetWMProtocols (dpy (), win (), &_atom, 1);
     _atom = XInternAtom (dpy (), "WM_PROTOCOLS", True);
 
-    sprintf (s, "%s  (zita-at1-%s)", jclient->jname (), VERSION);
-    x_set_title (s);
+    set_title ();
     H.position (xp, yp);
-    H.minsize (XSIZE, YSIZE);
-    H.maxsize (XSIZE, YSIZE);
+    H.minsize (_xsize, YSIZE);
+    H.maxsize (_xsize, YSIZE);
     H.rname (xres->rname ());
     H.rclas (xres->rclas ());
     x_apply (&H); 
@@ -70,6 +75,15 @@ Mainwin::Mainwin (X_rootwin *parent, X_resman *xres, int xp, int yp, Jclient *jc
     _midich = 0;
     _jclient->set_midichan (-1);
 
+    // Input channel selection, only with more than one.
+    _inpch = 0;
+    _binpc = 0;
+    if (_jclient->nchan () > 1)
+    {
+        _binpc = new X_tbutton (this, this, &bstyle1, 592, 27, "In 1", 0, B_INPC);
+        _binpc->x_map ();
+    }
+
     _tmeter = new Tmeter (this, 80, 53);
     _tmeter->x_map ();
     y = 23;
@@ -105,17 +119,16 @@ Mainwin::Mainwin (X_rootwin *parent, X_resman *xres, int xp, int yp, Jclient *jc
     _textln = new X_textip (this, 0, &tstyle1, 0, 0, 50, 15, 15);
     _textln->set_align (0);
     _ttimer = 0;
+    _learn = -1;
+    _ccount = 0;
+    _ancurs = 0;
 
-    _notes = 0xFFF;
-    _jclient->set_notemask (_notes);
-    _jclient->retuner ()->set_refpitch (_rotary [R_TUNE]->value ());
-    _jclient->retuner ()->set_notebias (_rotary [R_BIAS]->value ());
-    _jclient->retuner ()->set_corrfilt (_rotary [R_FILT]->value ());
-    _jclient->retuner ()->set_corrgain (_rotary [R_CORR]->value ());
-    _jclient->retuner ()->set_corroffs (_rotary [R_OFFS]->value ());
+    // The controls show the values held by the Jclient,
+    // which may have been set from the command line.
+    showinpc ();
 
+    // Mapped by show_gui ().
     x_add_events (ExposureMask);
-    x_map ();
     set_time (0);
     inc_time (500000);
 }
@@ -133,12 +146,23 @@ int Mainwin::process (void)
 
     if (_stop) handle_stop ();
 
-    e = get_event_timed ();
+    e = _timed ? get_event_timed () : get_event ();
     switch (e)
     {
     case EV_TIME:
         handle_time ();
         break;
+
+    case EV_RECONF:
+    case EV_PARAM:
+        // Restart the timer if stopped, see handle_time ().
+        if (! _timed)
+        {
+            set_time (0);
+            inc_time (50000);
+            _timed = true;
+        }
+        break;
     }
     return e;
 }
@@ -168,18 +192,51 @@ void Mainwin::expose (XExposeEvent *E)
 
 void Mainwin::clmesg (XClientMessageEvent *E)
 {
-    if (E->message_type == _atom) _stop = true;
+    if (E->message_type != _atom) return;
+    // Under NSM closing the window only hides it.
+    if (_managed) show_gui (false);
+    else _stop = true;
 }
 
 
 void Mainwin::handle_time (void)
 {
-    int   i, k, s;
-    float v;
+    int       i, k, s;
+    float     e0, e1;
+    Anrecord  A;
 
-    v = _jclient->retuner ()->get_error ();
-    _tmeter->update (v, v);
-    k = _jclient->retuner ()->get_noteset ();
+    if (! _shown)
+    {
+        // Nothing is drawn while hidden, only the dirty state
+        // is kept up to date. The controls are updated when
+        // shown again. The timer runs only to complete a
+        // reconfiguration, or once per second for telemetry,
+        // otherwise it is restarted by an OSC parameter change
+        // or a reconfiguration. MIDI CC changes are seen at
+        // the next wakeup, at the latest by an NSM save.
+        if (_jclient->get_ccount () != _ccount)
+        {
+            _ccount = _jclient->get_ccount ();
+            setdirty ();
+        }
+        if (_jclient->reconf_busy ()) inc_time (50000);
+        else if (_telem) inc_time (1000000);
+        else _timed = false;
+        return;
+    }
+
+    // Range of the error and the notes found by the pitch
+    // estimates made since the previous update.
+    k = 0;
+    e0 = 1e3f;
+    e1 = -1e3f;
+    while (_jclient->get_anrecord (_inpch, &_ancurs, &A))
+    {
+        if (A.error < e0) e0 = A.error;
+        if (A.error > e1) e1 = A.error;
+        if (A.note >= 0) k |= 1 << A.note;
+    }
+    if (e0 <= e1) _tmeter->update (e0, e1);
     for (i = 0; i < 12; i++)
     {
         s = _bnote [i]->state ();
@@ -195,11 +252,75 @@ void Mainwin::handle_time (void)
     {
         if (--_ttimer == 0) _textln->x_unmap ();
     }
+    if ((_learn >= 0) && ! _jclient->get_cclearn ()) showlearn ();
+    if (_jclient->get_ccount () != _ccount)
+    {
+        // Parameters changed by MIDI CC or OSC.
+        _ccount = _jclient->get_ccount ();
+        showinpc ();
+        setdirty ();
+    }
     inc_time (50000);
     XFlush (dpy ());
 }
 
 
+void Mainwin::set_title (void)
+{
+    char s [256];
+
+    // Also after an NSM session switch, which may change
+    // the JACK client name.
+    snprintf (s, 256, "%s  (zita-at1-%s)", _jclient->jname (), VERSION);
+    x_set_title (s);
+}
+
+
+void Mainwin::show_stats (const Jclient::Jstats *S)
+{
+    char s [256];
+
+    // Shown in the window title: DSP load, xruns, the mean,
+    // p99 and worst callback time, and the mean time per
+    // period for resampling, interpolation and analysis.
+    // Times in us.
+    if (! _shown) return;
+    snprintf (s, 256, "%s  (zita-at1-%s)  DSP %.0f%%  xruns %u  cb %.0f/%.0f/%.0f  rs %.0f  ip %.0f  an %.0f",
+              _jclient->jname (), VERSION, S->cpuload, S->xruns,
+              1e-3f * S->tmean, 1e-3f * S->tp99, 1e-3f * S->tmax,
+              1e-3f * S->phase [Retuner::PH_RESAMP], 1e-3f * S->phase [Retuner::PH_INTERP],
+              1e-3f * S->phase [Retuner::PH_ANALYSE]);
+    x_set_title (s);
+}
+
+
+void Mainwin::show_gui (bool s)
+{
+    // When hidden the window is only unmapped, so showing
+    // it again is immediate.
+    if (s != _shown)
+    {
+        _shown = s;
+        if (s)
+        {
+            _ccount = _jclient->get_ccount ();
+            showinpc ();
+            x_map ();
+            set_time (0);
+            inc_time (50000);
+            _timed = true;
+        }
+        else x_unmap ();
+        XFlush (dpy ());
+    }
+    if (nsm)
+    {
+        if (s) nsm->gui_is_shown ();
+        else nsm->gui_is_hidden ();
+    }
+}
+
+
 void Mainwin::handle_stop (void)
 {
     put_event (EV_EXIT, 1);
@@ -211,7 +332,6 @@ void Mainwin::handle_callb (int type, X_window *W, XEvent *E)
     PushButton *B;
     RotaryCtl  *R;
     int         k, s;
-    float       v;
 
     switch (type)
     {
@@ -234,6 +354,19 @@ void Mainwin::handle_callb (int type, X_window *W, XEvent *E)
 	        break;
 	    }
             break;
+	case B_INPC:
+	    switch (X->button)
+	    {
+	    case 1:
+	    case 4:
+		setinpc (1);
+	        break;
+	    case 3:
+	    case 5:
+		setinpc (-1);
+	        break;
+	    }
+            return;
 	}
 	break;
     }
@@ -245,13 +378,13 @@ void Mainwin::handle_callb (int type, X_window *W, XEvent *E)
 	    k = 1 << k;
 	    if (B->state () & 1) _notes |=  k;
 	    else                 _notes &= ~k;
-	    _jclient->set_notemask (_notes);
+	    _jclient->set_notemask (_inpch, _notes);
 	}
 	else if (k == B_LLAT)
 	{
 	    s = (B->state () & 1) ^ 1;
 	    B->set_state (s);
-	    _jclient->set_lowlat (s);
+	    _jclient->set_lowlat (_inpch, s);
 	}
 	else if (k == B_MIDI)
 	{
@@ -262,6 +395,12 @@ void Mainwin::handle_callb (int type, X_window *W, XEvent *E)
     case RotaryCtl::PRESS:
 	R = (RotaryCtl *) W;
 	k = R->cbind ();
+	if (R->keymod () & ControlMask)
+	{
+	    // Ctrl-click: MIDI learn, or remove with right button.
+	    cclearn (k, R->button ());
+	    return;
+	}
 	switch (k)
 	{
         case R_TUNE:
@@ -274,30 +413,23 @@ void Mainwin::handle_callb (int type, X_window *W, XEvent *E)
     case RotaryCtl::DELTA:
 	R = (RotaryCtl *) W;
 	k = R->cbind ();
+	setpar (_inpch, k, _rotary [k]->value ());
 	switch (k)
 	{
         case R_TUNE:
-            v = _rotary [R_TUNE]->value ();
-            _jclient->retuner ()->set_refpitch (v);
-	    showval (k);
-	    break;
-	case R_BIAS:   
-            _jclient->retuner ()->set_notebias (_rotary [R_BIAS]->value ());
-	    break;
-	case R_FILT:   
-            _jclient->retuner ()->set_corrfilt (_rotary [R_FILT]->value ());
-	    break;
-	case R_CORR:   
-            _jclient->retuner ()->set_corrgain (_rotary [R_CORR]->value ());
-	    break;
 	case R_OFFS:   
-            _jclient->retuner ()->set_corroffs (_rotary [R_OFFS]->value ());
 	    showval (k);
 	    break;
 	}
 	break;
     }
 
+    setdirty ();
+}
+
+
+void Mainwin::setdirty (void)
+{
     if (!_dirty)
     {
         if (nsm) nsm->is_dirty ();
@@ -323,6 +455,61 @@ void Mainwin::setchan (int d)
 }   
 
 
+void Mainwin::setinpc (int d)
+{
+    char s [16];
+
+    _inpch += d;
+    if (_inpch < 0) _inpch = 0;
+    if (_inpch >= _jclient->nchan ()) _inpch = _jclient->nchan () - 1;
+    sprintf (s, "In %d", _inpch + 1);
+    _binpc->set_text (s, 0);
+    showinpc ();
+}
+
+
+void Mainwin::showinpc (void)
+{
+    int i, k;
+
+    // Show the parameters of the selected input channel.
+    for (i = 0; i < NROTARY; i++) _rotary [i]->set_value (getpar (_inpch, i));
+    _notes = _jclient->get_notemask (_inpch);
+    for (i = 0, k = _notes; i < 12; i++, k >>= 1)
+    {
+        _bnote [i]->set_state ((_bnote [i]->state () & ~1) | (k & 1));
+    }
+    _bllat->set_state (_jclient->get_lowlat (_inpch) ? 1 : 0);
+}
+
+
+void Mainwin::setpar (int c, int k, float v)
+{
+    switch (k)
+    {
+    case R_TUNE: _jclient->set_refpitch (c, v); break;
+    case R_BIAS: _jclient->set_notebias (c, v); break;
+    case R_FILT: _jclient->set_corrfilt (c, v); break;
+    case R_CORR: _jclient->set_corrgain (c, v); break;
+    case R_OFFS: _jclient->set_corroffs (c, v); break;
+    }
+}
+
+
+float Mainwin::getpar (int c, int k)
+{
+    switch (k)
+    {
+    case R_TUNE: return _jclient->get_refpitch (c);
+    case R_BIAS: return _jclient->get_notebias (c);
+    case R_FILT: return _jclient->get_corrfilt (c);
+    case R_CORR: return _jclient->get_corrgain (c);
+    case R_OFFS: return _jclient->get_corroffs (c);
+    }
+    return 0;
+}
+
+
 void Mainwin::showval (int k)
 {
     char s [16];
@@ -331,19 +518,77 @@ void Mainwin::showval (int k)
     {
     case R_TUNE:
         sprintf (s, "%5.1lf", _rotary [R_TUNE]->value ());
-	_textln->x_move (285, 58);
 	break;
     case R_OFFS:
         sprintf (s, "%5.2lf", _rotary [R_OFFS]->value ());
-	_textln->x_move (525, 58);
 	break;
     }
+    showtext (k, s);
+}
+
+
+void Mainwin::showtext (int k, const char *s)
+{
+    static RotaryGeom *G [NROTARY] = { &r_tune_geom, &r_filt_geom, &r_bias_geom, &r_corr_geom, &r_offs_geom };
+
+    // Show a text below control 'k' for 2 seconds.
+    _textln->x_move (259 + G [k]->_x0, 58);
     _textln->set_text (s);
     _textln->x_map ();
     _ttimer = 40;
 }
 
 
+void Mainwin::cclearn (int k, int b)
+{
+    int  i, c;
+
+    if (b == 1)
+    {
+        // The next controller received is assigned
+        // to this parameter of the selected channel.
+        _learn = k;
+        _jclient->set_cclearn (k, _inpch);
+        showtext (k, "Learn");
+        _ttimer = 200;
+    }
+    else if (b == 3)
+    {
+        _learn = -1;
+        _jclient->set_cclearn (-1, 0);
+        for (i = 0; i < 128; i++)
+        {
+            if ((_jclient->get_ccmap (i, &c) == k) && ((c < 0) || (c == _inpch)))
+            {
+                _jclient->set_ccmap (i, -1, 0);
+            }
+        }
+        showtext (k, "No CC");
+        setdirty ();
+    }
+}
+
+
+void Mainwin::showlearn (void)
+{
+    int   i, c;
+    char  s [16];
+
+    // Learn completed, show the controller.
+    for (i = 0; i < 128; i++)
+    {
+        if ((_jclient->get_ccmap (i, &c) == _learn) && (c == _inpch)) break;
+    }
+    if (i < 128)
+    {
+        sprintf (s, "CC %d", i);
+        showtext (_learn, s);
+    }
+    _learn = -1;
+    setdirty ();
+}
+
+
 void Mainwin::redraw (void)
 {
     int x;
@@ -352,7 +597,7 @@ void Mainwin::redraw (void)
     XPutImage (dpy (), win (), dgc (), notesect_img, 0, 0, x, 0, 190, 75);
     x += 190;
     XPutImage (dpy (), win (), dgc (), ctrlsect_img, 0, 0, x, 0, 315, 75);
-    x = XSIZE - 35;
+    x = _xsize - 35;
     XPutImage (dpy (), win (), dgc (), redzita_img, 0, 0, x, 0, 35, 75);
     if (_managed)
     {
@@ -362,122 +607,33 @@ void Mainwin::redraw (void)
 }
 
 
-void Mainwin::load_state ()
+void Mainwin::load_state (void)
 {
-    ifstream statefile(_statefile.c_str());
-
-    if (statefile.is_open())
-    {
-        string parameter;
-        float  tune = 0.0f;
-        float  bias = 0.0f;
-        float  filt = 0.0f;
-        float  corr = 0.0f;
-        float  offs = 0.0f;
-        int   notes = 0xFFF;
-        int      xp = 100;
-        int      yp = 100;
-        int i;
-
-        while (!statefile.eof())
-        {
-            statefile >> parameter;
-            if (parameter == "/autotune/tune")
-            {
-                statefile >> dec >> tune;
-            }
-            else if (parameter == "/autotune/bias")
-            {
-                statefile >> dec >> bias;
-            }
-            else if (parameter == "/autotune/filt")
-            {
-                statefile >> dec >> filt;
-            }
-            else if (parameter == "/autotune/corr")
-            {
-                statefile >> dec >> corr;
-            }
-            else if (parameter == "/autotune/offs")
-            {
-                statefile >> dec >> offs;
-            }
-            else if (parameter == "/autotune/notes")
-            {
-                statefile >> hex >> notes;
-            }
-            else if (parameter == "/window/x")
-            {
-                statefile >> dec >> xp;
-            }
-            else if (parameter == "/window/y")
-            {
-                statefile >> dec >> yp;
-            }
-        }
-
-        statefile.close();
-
-        _rotary [R_TUNE]->set_value (tune);
-        _jclient->retuner ()->set_refpitch (_rotary [R_TUNE]->value ());
-        _rotary [R_BIAS]->set_value (bias);
-        _jclient->retuner ()->set_notebias (_rotary [R_BIAS]->value ());
-        _rotary [R_FILT]->set_value (filt);
-        _jclient->retuner ()->set_corrfilt (_rotary [R_FILT]->value ());
-        _rotary [R_CORR]->set_value (corr);
-        _jclient->retuner ()->set_corrgain (_rotary [R_CORR]->value ());
-        _rotary [R_OFFS]->set_value (offs);
-        _jclient->retuner ()->set_corroffs (_rotary [R_OFFS]->value ());
-
-        _notes = notes;
-        _jclient->set_notemask (_notes);
-
-        for (i = 0; i < 12; i++)
-        {
-            _bnote [i]->set_state (1 * (0x1 & notes));
-            notes >>= 1;
-        }
-        x_move (xp, yp);
-        redraw ();
-    }
+    int   xp, yp;
+    bool  s;
+
+    xp = yp = 100;
+    s = true;
+    if (state_load (_statefile.c_str (), _jclient, &xp, &yp, &s)) x_move (xp, yp);
+    showinpc ();
+    _dirty = false;
+    if (nsm) nsm->is_clean ();
+    // Only NSM can show a hidden window.
+    show_gui (s || ! _managed);
 }
 
 
 void Mainwin::save_state (void)
 {
-    ofstream statefile(_statefile.c_str());
-
-    if (statefile.is_open())
+    Window        w_return;
+    int           x_s, y_s, x, y;
+    unsigned int  w, h, b_w, d;
+
+    XGetGeometry (dpy (), win (), &w_return, &x, &y, &w, &h, &b_w, &d);
+    XTranslateCoordinates (dpy (), win (), pwin ()->win (),
+                           -x, -y, &x_s, &y_s, &w_return);
+    if (state_save (_statefile.c_str (), _jclient, x_s, y_s, _shown))
     {
-        float tune = _rotary [R_TUNE]->value ();
-        float bias = _rotary [R_BIAS]->value ();
-        float filt = _rotary [R_FILT]->value ();
-        float corr = _rotary [R_CORR]->value ();
-        float offs = _rotary [R_OFFS]->value ();
-        int  notes = _notes;
-
-        statefile << "/autotune/tune\t"  << dec << tune  << endl;
-        statefile << "/autotune/bias\t"  << dec << bias  << endl;
-        statefile << "/autotune/filt\t"  << dec << filt  << endl;
-        statefile << "/autotune/corr\t"  << dec << corr  << endl;
-        statefile << "/autotune/offs\t"  << dec << offs  << endl;
-        statefile << "/autotune/notes\t" << hex << notes << endl;
-
-        Window w_return;
-        int x_s, y_s, x, y;
-        unsigned int w, h;
-        unsigned int b_w;
-        unsigned int d;
-
-        XGetGeometry (dpy (), win (), &w_return, &x, &y, &w, &h, &b_w, &d);
-        XTranslateCoordinates (dpy (), win (), pwin ()->win (),
-                               -x, -y, &x_s, &y_s, &w_return);
-
-        statefile << "/window/x\t" << dec << x_s << endl;
-        statefile << "/window/y\t" << dec << y_s << endl;
-
-        statefile.close();
-
         _dirty = false;
         if (nsm) nsm->is_clean();
     }
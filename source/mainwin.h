@@ -36,7 +36,7 @@ class Mainwin : public A_thread, public X_window, public X_callback
 {
 public:
 
-    enum { XSIZE = 640, YSIZE = 75 };
+    enum { XSIZE = 640, YSIZE = 75, XCHAN = 60 };
 
     Mainwin (X_rootwin *parent, X_resman *xres, int xp, int yp, Jclient *jclient);
     ~Mainwin (void);
@@ -49,10 +49,15 @@ public:
     void save_state (void);
     void set_managed (bool);
     void set_statefile (const string s) { _statefile = s; }
+    void set_telemetry (bool s) { _telem = s; }
+    void set_title (void);
+    void show_stats (const Jclient::Jstats *S);
+    void show_gui (bool s);
+    bool gui_shown (void) const { return _shown; }
 
 private:
 
-    enum { B_LLAT = 12, B_MIDI, B_CHAN };
+    enum { B_LLAT = 12, B_MIDI, B_CHAN, B_INPC };
     enum { R_TUNE, R_FILT, R_BIAS, R_CORR, R_OFFS, NROTARY };
  
     virtual void thr_main (void) {}
@@ -62,10 +67,18 @@ private:
     void handle_event (XEvent *);
     void handle_callb (int type, X_window *W, XEvent *E);
     void showval (int k);
+    void showtext (int k, const char *s);
+    void cclearn (int k, int b);
+    void showlearn (void);
     void expose (XExposeEvent *E);
     void clmesg (XClientMessageEvent *E);
     void redraw (void);
+    void setdirty (void);
     void setchan (int d);
+    void setinpc (int d);
+    void showinpc (void);
+    void setpar (int c, int k, float v);
+    float getpar (int c, int k);
 
     Atom            _atom;
     bool            _stop;
@@ -80,11 +93,20 @@ private:
     Tmeter         *_tmeter;
     X_textip       *_textln;
     X_tbutton      *_bchan;
+    X_tbutton      *_binpc;
     int             _midich;
+    int             _inpch;
+    int             _xsize;
     int             _ttimer;
+    int             _learn;
+    unsigned int    _ccount;
+    unsigned int    _ancurs;
     string          _statefile;
     bool            _dirty;
     bool            _managed;
+    bool            _shown;
+    bool            _timed;
+    bool            _telem;
 
 };
 
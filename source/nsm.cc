@@ -20,27 +20,144 @@
 
 #include "nsm.h"
 #include "mainwin.h"
+#include "headless.h"
+#include "state.h"
+#include "global.h"
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+extern Jclient    *jclient;
 extern Mainwin    *mainwin;
+extern Headless   *headless;
 
-NSM_Client::NSM_Client()
+NSM_Client::NSM_Client() :
+    _target (0),
+    _opened (false),
+    _failed (false),
+    _req (0),
+    _done (0),
+    _result (ERR_OK)
 {
 }
 
+bool
+NSM_Client::wait_open(int timeout_ms)
+{
+    std::unique_lock<std::mutex> lock (_mutex);
+
+    // Called by main () after the announce. Returns true once
+    // the first open has been received, false if the server
+    // refused the announce or did not answer in time.
+    _cond.wait_for (lock, std::chrono::milliseconds (timeout_ms), [this] { return _opened || _failed; });
+    return _opened;
+}
+
+void
+NSM_Client::set_target(A_thread *target)
+{
+    std::lock_guard<std::mutex> lock (_mutex);
+    _target = target;
+}
+
+int
+NSM_Client::request(int req, bool wait)
+{
+    std::unique_lock<std::mutex> lock (_mutex);
+
+    // Called by the lo server thread. Until the main loop is
+    // running there is no one to handle the request.
+    if (!_target) return ERR_NOT_NOW;
+    _req |= req;
+    _done &= ~req;
+    _target->put_event (EV_NSM, 1);
+    if (!wait) return ERR_OK;
+    if (!_cond.wait_for (lock, std::chrono::milliseconds (REQ_TIMEOUT), [this, req] { return (_done & req) != 0; }))
+    {
+        return ERR_GENERAL;
+    }
+    return _result;
+}
+
+void
+NSM_Client::handle_requests(void)
+{
+    int req, r;
+
+    // Called by the main thread on EV_NSM.
+    {
+        std::lock_guard<std::mutex> lock (_mutex);
+        req = _req;
+        _req = 0;
+    }
+    r = ERR_OK;
+    if (req & REQ_OPEN) r = switch_session ();
+    if (req & REQ_SAVE)
+    {
+        if (mainwin) mainwin->save_state ();
+        else if (headless) headless->save_state ();
+    }
+    if (req & REQ_SHOW)
+    {
+        if (mainwin) mainwin->show_gui (true);
+        else gui_is_hidden ();
+    }
+    if (req & REQ_HIDE)
+    {
+        if (mainwin) mainwin->show_gui (false);
+        else gui_is_hidden ();
+    }
+    {
+        std::lock_guard<std::mutex> lock (_mutex);
+        _done |= req;
+        _result = r;
+    }
+    _cond.notify_all ();
+}
+
+int
+NSM_Client::switch_session(void)
+{
+    string name, id, file;
+
+    {
+        std::lock_guard<std::mutex> lock (_mutex);
+        name = _name;
+        id = _client_id;
+    }
+    // A new client ID means a new JACK client name.
+    if (strcmp (id.c_str (), jclient->jname ()) && jclient->rename (id.c_str ()))
+    {
+        return ERR_GENERAL;
+    }
+    // The client ID and path are read by the main thread only.
+    set_client (id.c_str (), name.c_str ());
+    file = name + ".conf";
+    state_reset (jclient);
+    if (mainwin)
+    {
+        mainwin->set_title ();
+        mainwin->set_statefile (file);
+        mainwin->load_state ();
+    }
+    else
+    {
+        headless->set_statefile (file);
+        headless->load_state ();
+    }
+    return ERR_OK;
+}
+
 int
 NSM_Client::command_save(char **out_msg)
 {
     (void) out_msg;
-    int r = ERR_OK;
 
-    mainwin->save_state ();
-
-    return r;
+    return request (REQ_SAVE, true);
 }
 
 int
@@ -49,12 +166,46 @@ NSM_Client::command_open(const char *name,
                          const char *client_id,
                          char **out_msg)
 {
-    int r = ERR_OK;
+    int r;
+
+    // The first open is handled by main (). Any later one is
+    // a session switch, done by the running engine.
+    {
+        std::lock_guard<std::mutex> lock (_mutex);
+        if (!_opened)
+        {
+            _opened = true;
+            _cond.notify_all ();
+            return ERR_OK;
+        }
+        _name = name;
+        _client_id = client_id;
+    }
+    r = request (REQ_OPEN, true);
+    if (r) *out_msg = strdup ("Can't switch to the new session");
     return r;
 }
 
 void
 NSM_Client::command_active(bool active)
 {
-    ;
+    std::lock_guard<std::mutex> lock (_mutex);
+
+    if (!active)
+    {
+        _failed = true;
+        _cond.notify_all ();
+    }
+}
+
+void
+NSM_Client::command_show_optional_gui(void)
+{
+    request (REQ_SHOW, false);
+}
+
+void
+NSM_Client::command_hide_optional_gui(void)
+{
+    request (REQ_HIDE, false);
 }
@@ -19,8 +19,17 @@
 
 #pragma once
 
+#include <string>
+#include <mutex>
+#include <condition_variable>
+#include <clthreads.h>
 #include "nsmclient.h"
 
+// The NSM messages are received by the lo server thread.
+// Anything that touches the engine or the GUI is passed to
+// the main thread as an EV_NSM event, the handler waits for
+// the result where NSM expects a reply.
+
 class NSM_Client:public NSM::Client
 {
     public:
@@ -28,6 +37,10 @@ class NSM_Client:public NSM::Client
         NSM_Client();
         ~NSM_Client() { }
 
+        bool wait_open(int timeout_ms);
+        void set_target(A_thread *target);
+        void handle_requests(void);
+
     protected:
 
         int command_open(const char *name,
@@ -37,5 +50,25 @@ class NSM_Client:public NSM::Client
         int command_save(char **out_msg);
 
         void command_active(bool active);
-};
+        void command_show_optional_gui(void);
+        void command_hide_optional_gui(void);
+
+    private:
 
+        enum { REQ_OPEN = 1, REQ_SAVE = 2, REQ_SHOW = 4, REQ_HIDE = 8 };
+        enum { REQ_TIMEOUT = 10000 };
+
+        int  request(int req, bool wait);
+        int  switch_session(void);
+
+        std::mutex               _mutex;
+        std::condition_variable  _cond;
+        A_thread                *_target;
+        bool                     _opened;
+        bool                     _failed;
+        int                      _req;
+        int                      _done;
+        int                      _result;
+        std::string              _name;
+        std::string              _client_id;
+};
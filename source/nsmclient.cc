@@ -122,6 +122,24 @@ namespace NSM
     }
 
 
+    void
+    Client::gui_is_shown ( void )
+    {
+        if ( nsm_is_active )
+        {
+            lo_send_from( nsm_addr, _server, LO_TT_IMMEDIATE, "/nsm/client/gui_is_shown", "" );
+        }
+    }
+
+    void
+    Client::gui_is_hidden ( void )
+    {
+        if ( nsm_is_active )
+        {
+            lo_send_from( nsm_addr, _server, LO_TT_IMMEDIATE, "/nsm/client/gui_is_hidden", "" );
+        }
+    }
+
     void
     Client::broadcast ( lo_message msg )
     {
@@ -169,6 +187,8 @@ namespace NSM
         lo_server_add_method( _server, "/nsm/client/open", "sss", &Client::osc_open, this );
         lo_server_add_method( _server, "/nsm/client/save", "", &Client::osc_save, this );
         lo_server_add_method( _server, "/nsm/client/session_is_loaded", "", &Client::osc_session_is_loaded, this );
+        lo_server_add_method( _server, "/nsm/client/show_optional_gui", "", &Client::osc_show_optional_gui, this );
+        lo_server_add_method( _server, "/nsm/client/hide_optional_gui", "", &Client::osc_hide_optional_gui, this );
         lo_server_add_method( _server, NULL, NULL, &Client::osc_broadcast, this );
 
         return 0;
@@ -194,6 +214,8 @@ namespace NSM
         lo_server_thread_add_method( _st, "/nsm/client/open", "sss", &Client::osc_open, this );
         lo_server_thread_add_method( _st, "/nsm/client/save", "", &Client::osc_save, this );
         lo_server_thread_add_method( _st, "/nsm/client/session_is_loaded", "", &Client::osc_session_is_loaded, this );
+        lo_server_thread_add_method( _st, "/nsm/client/show_optional_gui", "", &Client::osc_show_optional_gui, this );
+        lo_server_thread_add_method( _st, "/nsm/client/hide_optional_gui", "", &Client::osc_hide_optional_gui, this );
         lo_server_thread_add_method( _st, NULL, NULL, &Client::osc_broadcast, this );
 
         return 0;
@@ -227,6 +249,15 @@ namespace NSM
          return 0;
     }
 
+    void
+    Client::set_client ( const char *client_id, const char *client_path )
+    {
+        free( _nsm_client_id );
+        free( _nsm_client_path );
+        _nsm_client_id = strdup( client_id );
+        _nsm_client_path = strdup( client_path );
+    }
+
     int
     Client::osc_open ( const char *path, const char *types, lo_arg **argv, int argc, lo_message msg, void *user_data )
     {
@@ -234,8 +265,9 @@ namespace NSM
 
         NSM::Client *nsm = (NSM::Client*)user_data;
 
-        nsm->_nsm_client_id = strdup( &argv[2]->s );
-        nsm->_nsm_client_path = strdup( &argv[0]->s );
+        /* a switch to another session is left to command_open() */
+        if ( ! nsm->_nsm_client_id )
+            nsm->set_client( &argv[2]->s, &argv[0]->s );
 
         int r = ((NSM::Client*)user_data)->command_open( &argv[0]->s, &argv[1]->s, &argv[2]->s, &out_msg);
 
@@ -260,6 +292,26 @@ namespace NSM
         return 0;
     }
 
+    int
+    Client::osc_show_optional_gui ( const char *path, const char *types, lo_arg **argv, int argc, lo_message msg, void *user_data )
+    {
+        NSM::Client *nsm = (NSM::Client*)user_data;
+
+        nsm->command_show_optional_gui();
+
+        return 0;
+    }
+
+    int
+    Client::osc_hide_optional_gui ( const char *path, const char *types, lo_arg **argv, int argc, lo_message msg, void *user_data )
+    {
+        NSM::Client *nsm = (NSM::Client*)user_data;
+
+        nsm->command_hide_optional_gui();
+
+        return 0;
+    }
+
     int
     Client::osc_error ( const char *path, const char *types, lo_arg **argv, int argc, lo_message msg, void *user_data )
     {
@@ -69,6 +69,8 @@ namespace NSM
         void is_clean ( void );
         void progress ( float f );
         void message( int priority, const char *msg );
+        void gui_is_shown ( void );
+        void gui_is_hidden ( void );
         void announce ( const char *appliction_name, const char *capabilities, const char *process_name );
 
         void broadcast ( lo_message msg );
@@ -87,6 +89,10 @@ namespace NSM
 
     protected:
 
+        /* set by the first open, a later one must call this from
+           the thread that reads client_id() and client_path() */
+        void set_client ( const char *client_id, const char *client_path );
+
         /* Server->Client methods */
         virtual int command_open ( const char *name, const char *display_name, const char *client_id, char **out_msg ) = 0;
         virtual int command_save ( char **out_msg ) = 0;
@@ -95,6 +101,10 @@ namespace NSM
 
         virtual void command_session_is_loaded ( void ) { }
 
+        /* only with the :optional-gui: capability */
+        virtual void command_show_optional_gui ( void ) { }
+        virtual void command_hide_optional_gui ( void ) { }
+
         /* invoked when an unrecognized message is received. Should return 0 if you handled it, -1 otherwise. */
         virtual int command_broadcast ( const char *, lo_message ) { return -1; }
 
@@ -106,6 +116,8 @@ namespace NSM
         static int osc_announce_reply ( const char *path, const char *types, lo_arg **argv, int argc, lo_message msg, void *user_data );
         static int osc_error ( const char *path, const char *types, lo_arg **argv, int argc, lo_message msg, void *user_data );
         static int osc_session_is_loaded ( const char *path, const char *types, lo_arg **argv, int argc, lo_message msg, void *user_data );
+        static int osc_show_optional_gui ( const char *path, const char *types, lo_arg **argv, int argc, lo_message msg, void *user_data );
+        static int osc_hide_optional_gui ( const char *path, const char *types, lo_arg **argv, int argc, lo_message msg, void *user_data );
         static int osc_broadcast ( const char *path, const char *types, lo_arg **argv, int argc, lo_message msg, void *user_data );
 
     };
@@ -0,0 +1,269 @@
+// ----------------------------------------------------------------------------
+//
+//  Copyright (C) 2010-2024 Fons Adriaensen <fons@linuxaudio.org>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// ----------------------------------------------------------------------------
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include "oscserver.h"
+
+
+// Parameter names, in the order of the Jclient enum.
+static const char *parname [] = { "tune", "filt", "bias", "corr", "offs", "llat", "notes", 0 };
+
+
+Oscserver::Oscserver (Jclient *jclient) :
+    _jclient (jclient),
+    _server (0),
+    _nsubs (0),
+    _tper (50000000LL),
+    _tnext (0),
+    _stop (false),
+    _done (false)
+{
+    memset (_cursor, 0, sizeof (_cursor));
+}
+
+
+Oscserver::~Oscserver (void)
+{
+    int i;
+
+    stop ();
+    for (i = 0; i < _nsubs; i++) lo_address_free (_subs [i]);
+    if (_server) lo_server_free (_server);
+}
+
+
+int Oscserver::start (const char *port)
+{
+    _server = lo_server_new_with_proto (port, LO_UDP, 0);
+    if (! _server) return 1;
+    lo_server_add_method (_server, 0, 0, static_message, this);
+    if (thr_start (SCHED_OTHER, 0, 0x10000))
+    {
+        lo_server_free (_server);
+        _server = 0;
+        return 1;
+    }
+    return 0;
+}
+
+
+void Oscserver::stop (void)
+{
+    if (! _server || _done) return;
+    _stop = true;
+    while (! _done) usleep (1000);
+}
+
+
+void Oscserver::thr_main (void)
+{
+    long long t;
+
+    // Messages are handled as they arrive, the analysis
+    // records are collected and sent every '_tper' ns.
+    // Retuners replaced by a reconfiguration are deleted
+    // only after an_release () has been called, so this
+    // is done on each pass, outside telemetry ().
+
+    _jclient->an_register (true);
+    _tnext = nsec_time ();
+    while (! _stop)
+    {
+        _jclient->an_release ();
+        lo_server_recv_noblock (_server, 10);
+        t = nsec_time ();
+        if (t >= _tnext)
+        {
+            telemetry ();
+            _tnext += _tper;
+            if (_tnext < t) _tnext = t + _tper;
+        }
+    }
+    _jclient->an_register (false);
+    _done = true;
+}
+
+
+int Oscserver::message (const char *path, const char *types, lo_arg **argv, int argc, lo_message msg)
+{
+    int    c, k;
+    float  v;
+    char   *q;
+    const char *p;
+
+    if (strncmp (path, "/autotune/", 10)) return 1;
+    p = path + 10;
+    if (! strcmp (p, "subscribe"))
+    {
+        subscribe (msg, ((argc > 0) && (types [0] == 'f')) ? argv [0]->f : 20.0f);
+        return 0;
+    }
+    if (! strcmp (p, "unsubscribe"))
+    {
+        unsubscribe (msg);
+        return 0;
+    }
+
+    // Optional channel number, then the parameter name.
+    c = -1;
+    if (isdigit (*p))
+    {
+        c = strtol (p, &q, 10) - 1;
+        if ((*q != '/') || (c < 0) || (c >= _jclient->nchan ())) return 1;
+        p = q + 1;
+    }
+    for (k = 0; parname [k]; k++)
+    {
+        if (! strcmp (p, parname [k])) break;
+    }
+    if (! parname [k] || (argc < 1)) return 1;
+    switch (types [0])
+    {
+    case 'f': v = argv [0]->f; break;
+    case 'i': v = argv [0]->i; break;
+    default: return 1;
+    }
+
+    if (c >= 0) _jclient->set_param (Jclient::SRC_OSC, c, k, v);
+    else
+    {
+        for (c = 0; c < _jclient->nchan (); c++) _jclient->set_param (Jclient::SRC_OSC, c, k, v);
+    }
+    return 0;
+}
+
+
+void Oscserver::subscribe (lo_message msg, float rate)
+{
+    int         i;
+    char        *u, *s;
+    lo_address  A;
+
+    // The rate is shared by all subscribers, the last
+    // one to subscribe sets it.
+
+    if (rate < 1.0f) rate = 1.0f;
+    if (rate > 100.0f) rate = 100.0f;
+    _tper = (long long)(1e9f / rate);
+
+    A = lo_message_get_source (msg);
+    if (! A) return;
+    u = lo_address_get_url (A);
+    for (i = 0; i < _nsubs; i++)
+    {
+        s = lo_address_get_url (_subs [i]);
+        if (! strcmp (s, u)) break;
+        free (s);
+    }
+    if (i < _nsubs) free (s);
+    else if (_nsubs < MAXSUBS)
+    {
+        _subs [_nsubs++] = lo_address_new_from_url (u);
+    }
+    else fprintf (stderr, "OSC: too many subscribers, ignored %s.\n", u);
+    free (u);
+}
+
+
+void Oscserver::unsubscribe (lo_message msg)
+{
+    int         i;
+    char        *u, *s;
+    lo_address  A;
+
+    A = lo_message_get_source (msg);
+    if (! A) return;
+    u = lo_address_get_url (A);
+    for (i = 0; i < _nsubs; i++)
+    {
+        s = lo_address_get_url (_subs [i]);
+        if (! strcmp (s, u))
+        {
+            free (s);
+            lo_address_free (_subs [i]);
+            _subs [i] = _subs [--_nsubs];
+            break;
+        }
+        free (s);
+    }
+    free (u);
+}
+
+
+void Oscserver::telemetry (void)
+{
+    int         c, n;
+    Anrecord    A;
+    lo_bundle   B;
+    lo_message  M;
+
+    // The records are read even without subscribers, so
+    // a new one starts with the current ones. Each bundle
+    // holds at most MAXBUND messages, to keep it within
+    // a single UDP packet.
+
+    B = 0;
+    n = 0;
+    for (c = 0; c < _jclient->nchan (); c++)
+    {
+        while (_jclient->get_anrecord (c, _cursor + c, &A))
+        {
+            if (! _nsubs) continue;
+            if (! B) B = lo_bundle_new (LO_TT_IMMEDIATE);
+            M = lo_message_new ();
+            lo_message_add_int32 (M, c + 1);
+            lo_message_add_int32 (M, A.time);
+            lo_message_add_float (M, A.period);
+            lo_message_add_int32 (M, A.note);
+            lo_message_add_float (M, A.error);
+            lo_message_add_float (M, A.ratio);
+            lo_message_add_int32 (M, A.voiced);
+            lo_message_add_int32 (M, A.jump);
+            lo_bundle_add_message (B, "/autotune/analysis", M);
+            if (++n == MAXBUND)
+            {
+                sendbundle (B);
+                B = 0;
+                n = 0;
+            }
+        }
+    }
+    if (B) sendbundle (B);
+}
+
+
+void Oscserver::sendbundle (lo_bundle B)
+{
+    int i;
+
+    for (i = 0; i < _nsubs; i++) lo_send_bundle_from (_subs [i], _server, B);
+    lo_bundle_free_recursive (B);
+}
+
+
+int Oscserver::static_message (const char *path, const char *types, lo_arg **argv,
+                               int argc, lo_message msg, void *arg)
+{
+    return ((Oscserver *) arg)->message (path, types, argv, argc, msg);
+}
@@ -0,0 +1,84 @@
+// ----------------------------------------------------------------------------
+//
+//  Copyright (C) 2010-2024 Fons Adriaensen <fons@linuxaudio.org>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// ----------------------------------------------------------------------------
+
+
+#ifndef __OSCSERVER_H
+#define __OSCSERVER_H
+
+
+#include <atomic>
+#include <lo/lo.h>
+#include <clthreads.h>
+#include "jclient.h"
+
+
+// OSC control, on its own thread. Accepted messages:
+//
+//   /autotune/subscribe [f]         Send analysis records to the
+//                                   sender, optionally at a rate
+//                                   in Hz, default 20.
+//   /autotune/unsubscribe           Stop sending them.
+//   /autotune/[<c>/]<par> f|i       Set a parameter of channel c,
+//                                   counting from 1, or of all
+//                                   channels.
+//
+// with <par> one of tune, filt, bias, corr, offs, llat or notes,
+// the last taking the note mask as an integer. Analysis records
+// are sent as bundles of /autotune/analysis messages with
+// arguments channel, time, period, note, error, ratio, voiced
+// and jump.
+
+class Oscserver : public P_thread
+{
+public:
+
+    Oscserver (Jclient *jclient);
+    ~Oscserver (void);
+
+    int  start (const char *port);
+    void stop (void);
+
+private:
+
+    enum { MAXSUBS = 8, MAXBUND = 32 };
+
+    virtual void thr_main (void);
+
+    int  message (const char *path, const char *types, lo_arg **argv, int argc, lo_message msg);
+    void subscribe (lo_message msg, float rate);
+    void unsubscribe (lo_message msg);
+    void telemetry (void);
+    void sendbundle (lo_bundle B);
+
+    Jclient         *_jclient;
+    lo_server        _server;
+    lo_address       _subs [MAXSUBS];
+    int              _nsubs;
+    long long        _tper;
+    long long        _tnext;
+    std::atomic<bool> _stop;
+    std::atomic<bool> _done;
+    unsigned int     _cursor [Jclient::MAXCHAN];
+
+    static int static_message (const char *path, const char *types, lo_arg **argv,
+                               int argc, lo_message msg, void *arg);
+};
+
+
+#endif
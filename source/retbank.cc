@@ -0,0 +1,340 @@
+// ----------------------------------------------------------------------------
+//
+//  Copyright (C) 2010-2024 Fons Adriaensen <fons@linuxaudio.org>
+//    
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// ----------------------------------------------------------------------------
+
+
+
+#include "retbank.h"
+
+
+typedef float vflt __attribute__ ((vector_size (4 * Retbank::NLANE)));
+typedef int   vint __attribute__ ((vector_size (4 * Retbank::NLANE)));
+
+
+static const float zero = 0.0f;
+
+
+static inline vflt cubic (vflt v0, vflt v1, vflt v2, vflt v3, vflt a)
+{
+    vflt b, c;
+
+    // Same as Retuner::cubic(), for all lanes.
+    b = 1 - a;
+    c = a * b;
+    return (1.0f + 1.5f * c) * (v1 * b + v2 * a)
+            - 0.5f * c * (v0 * b + v1 + v2 + v3 * a);
+}
+
+
+Retbank::Retbank (void) :
+    _nlane (0),
+    _fftlen (0),
+    _fdist (0),
+    _Tdata (0),
+    _Fdata (0)
+{
+}
+
+
+Retbank::~Retbank (void)
+{
+    int i;
+
+    if (! _fftlen) return;
+    for (i = 0; i < NLANE; i++)
+    {
+        fftwf_destroy_plan (_fwdplan [i]);
+        fftwf_destroy_plan (_invplan [i]);
+    }
+    fftwf_free (_Tdata);
+    fftwf_free (_Fdata);
+}
+
+
+void Retbank::init (Retuner *R)
+{
+    int  i, n;
+
+    // Create batched FFT plans for 1 to NLANE transforms,
+    // using the FFT size of Retuner 'R'. Transforms are
+    // stored one after the other, the spectra are padded
+    // to keep them aligned. Not RT-safe.
+
+    n = R->_fftlen;
+    _fftlen = n;
+    _fdist = n / 2 + 2;
+    _Tdata = (float *) fftwf_malloc (NLANE * n * sizeof (float));
+    _Fdata = (fftwf_complex *) fftwf_malloc (NLANE * _fdist * sizeof (fftwf_complex));
+    for (i = 0; i < NLANE; i++)
+    {
+        _fwdplan [i] = fftwf_plan_many_dft_r2c (1, &n, i + 1, _Tdata, 0, 1, n,
+                                                _Fdata, 0, 1, _fdist, FFTW_ESTIMATE);
+        _invplan [i] = fftwf_plan_many_dft_c2r (1, &n, i + 1, _Fdata, 0, 1, _fdist,
+                                                _Tdata, 0, 1, n, FFTW_ESTIMATE);
+    }
+}
+
+
+void Retbank::set_lanes (int nlane, Retuner **R)
+{
+    int i;
+
+    if (nlane > NLANE) nlane = NLANE;
+    for (i = 0; i < nlane; i++) _lane [i] = R [i];
+    _nlane = nlane;
+}
+
+
+bool Retbank::lockstep (void)
+{
+    int      i;
+    Retuner  *R, *S;
+
+    // The lanes must have the same buffer sizes, and be
+    // at the same position in a fragment. This is always
+    // the case for Retuners created together and fed the
+    // same number of frames.
+
+    if (_nlane < 2) return false;
+    R = _lane [0];
+    for (i = 1; i < _nlane; i++)
+    {
+        S = _lane [i];
+        if (   (S->_frsize != R->_frsize)
+            || (S->_frindex != R->_frindex)
+            || (S->_ipsize != R->_ipsize)
+            || (S->_upsamp != R->_upsamp)
+            || (S->_rssize != R->_rssize)) return false;
+    }
+    return true;
+}
+
+
+int Retbank::process (int nfram, float **inp, float **out)
+{
+    int        i, k, offs;
+    float      *rsp [NLANE];
+    long long  t = 0;
+    Retuner    *R;
+
+    if (! lockstep ())
+    {
+        for (i = 0; i < _nlane; i++) _lane [i]->process (nfram, inp [i], out [i]);
+        return 0;
+    }
+
+    // Block mode works as in Retuner::process ().
+    R = _lane [0];
+    if (R->_rsbuff && (nfram > R->_frsize))
+    {
+        offs = 0;
+        while (nfram)
+        {
+            k = (nfram < R->_rssize) ? nfram : R->_rssize;
+            if (R->_timing) t = nsec_time ();
+            for (i = 0; i < _nlane; i++) rsp [i] = _lane [i]->blockinput (k, inp [i] + offs);
+            if (R->_timing) R->phtime (Retuner::PH_RESAMP, t);
+            procfrags (k, offs, inp, out, rsp);
+            nfram -= k;
+            offs += k;
+        }
+    }
+    else
+    {
+        for (i = 0; i < _nlane; i++) rsp [i] = 0;
+        procfrags (nfram, 0, inp, out, rsp);
+    }
+
+    return 0;
+}
+
+
+void Retbank::procfrags (int nfram, int offs, float **inp, float **out, float **rsp)
+{
+    int        i, k, n;
+    long long  t = 0;
+    Retuner    *R, *T, *D [NLANE];
+
+    // As Retuner::procfrags (), but with the output
+    // of all lanes computed together. Phase times of
+    // the group are counted by the first lane.
+
+    T = _lane [0];
+    if (T->_timing) t = nsec_time ();
+    while (nfram)
+    {
+        k = T->_frsize - T->_frindex;
+        if (nfram < k) k = nfram;
+        nfram -= k;
+        for (i = 0; i < _nlane; i++) rsp [i] = _lane [i]->fraginput (k, inp [i] + offs, rsp [i]);
+        if (T->_timing) t = T->phtime (Retuner::PH_RESAMP, t);
+        fragoutput (k, offs, out);
+        for (i = 0; i < _nlane; i++) _lane [i]->ctloutput (k);
+        if (T->_timing) t = T->phtime (Retuner::PH_INTERP, t);
+
+        // At the end of the fragment, pitch estimates that
+        // are due are made together, then each lane decides
+        // on a jump.
+        n = 0;
+        for (i = 0; i < _nlane; i++)
+        {
+            R = _lane [i];
+            if ((R->_frindex == R->_frsize) && (++R->_frcount == 4))
+            {
+                R->_frcount = 0;
+                D [n++] = R;
+            }
+        }
+        if (n) analyse (n, D);
+        for (i = 0; i < _nlane; i++)
+        {
+            R = _lane [i];
+            if (R->_frindex == R->_frsize) R->fragjump ();
+        }
+        if (T->_timing) t = T->phtime (Retuner::PH_ANALYSE, t);
+        offs += k;
+    }
+}
+
+
+void Retbank::fragoutput (int k, int offs, float **out)
+{
+    int          i, j, l, n, fi;
+    int          xs [NLANE];
+    const float  *xp [NLANE];
+    const float  *ip [NLANE];
+    const float  *p;
+    vflt         a, b, dr, sz, w, y;
+    vflt         a0, a1, a2, a3, b0, b1, b2, b3;
+    vint         ia, ib;
+    Retuner      *R;
+
+    // Each lane reads at 'a' and, while crossfading, at 'b'.
+    // Lanes not crossfading have b == a and a zero crossfade
+    // gain, so all lanes run the same code. Unused lanes
+    // repeat the first one and their output is discarded.
+
+    for (l = 0; l < NLANE; l++)
+    {
+        R = _lane [(l < _nlane) ? l : 0];
+        a [l] = R->_rindex1;
+        b [l] = R->_xfade ? R->_rindex2 : R->_rindex1;
+        dr [l] = R->_upsamp ? 2 * R->_ratio : R->_ratio;
+        sz [l] = R->_ipsize;
+        ip [l] = R->_ipbuff;
+    }
+
+    fi = _lane [0]->_frindex;
+    while (k)
+    {
+        // Split at the end of any crossfade.
+        n = k;
+        for (l = 0; l < NLANE; l++)
+        {
+            R = _lane [(l < _nlane) ? l : 0];
+            if (R->_xfade)
+            {
+                if (R->_xflen - fi < n) n = R->_xflen - fi;
+                xp [l] = R->_xffunc + R->_xfstep * fi;
+                xs [l] = R->_xfstep;
+            }
+            else
+            {
+                xp [l] = &zero;
+                xs [l] = 0;
+            }
+        }
+
+        for (j = 0; j < n; j++)
+        {
+            ia = __builtin_convertvector (a, vint);
+            ib = __builtin_convertvector (b, vint);
+            for (l = 0; l < NLANE; l++)
+            {
+                p = ip [l] + ia [l];
+                a0 [l] = p [0];
+                a1 [l] = p [1];
+                a2 [l] = p [2];
+                a3 [l] = p [3];
+                p = ip [l] + ib [l];
+                b0 [l] = p [0];
+                b1 [l] = p [1];
+                b2 [l] = p [2];
+                b3 [l] = p [3];
+                w [l] = xp [l][xs [l] * j];
+            }
+            y =   (1 - w) * cubic (a0, a1, a2, a3, a - __builtin_convertvector (ia, vflt))
+                + w * cubic (b0, b1, b2, b3, b - __builtin_convertvector (ib, vflt));
+            for (i = 0; i < _nlane; i++) out [i][offs + j] = y [i];
+            a += dr;
+            a = (a >= sz) ? a - sz : a;
+            b += dr;
+            b = (b >= sz) ? b - sz : b;
+        }
+        offs += n;
+        fi += n;
+        k -= n;
+
+        // Lanes that completed a crossfade continue
+        // from the second read index.
+        for (l = 0; l < NLANE; l++)
+        {
+            R = _lane [(l < _nlane) ? l : 0];
+            if (R->_xfade && (fi == R->_xflen))
+            {
+                a [l] = b [l];
+                if (l < _nlane)
+                {
+                    R->_rindex2 = b [l];
+                    R->_xfade = false;
+                }
+            }
+        }
+    }
+
+    for (l = 0; l < _nlane; l++)
+    {
+        R = _lane [l];
+        R->_rindex1 = a [l];
+        if (R->_xfade) R->_rindex2 = b [l];
+        R->_frindex = fi;
+    }
+}
+
+
+void Retbank::analyse (int n, Retuner **R)
+{
+    int  i;
+
+    // Same as Retuner::findcycle () for 'n' Retuners,
+    // with a single FFT call in each direction.
+
+    if (R [0]->_fftlen != _fftlen)
+    {
+        for (i = 0; i < n; i++) R [i]->newcycle (R [i]->findcycle ());
+        return;
+    }
+    for (i = 0; i < n; i++) R [i]->anwindow (_Tdata + i * _fftlen);
+    fftwf_execute (_fwdplan [n - 1]);
+    for (i = 0; i < n; i++) R [i]->anpower (_Fdata + i * _fdist);
+    fftwf_execute (_invplan [n - 1]);
+    for (i = 0; i < n; i++)
+    {
+        R [i]->newcycle (R [i]->anpeaks (_Tdata + i * _fftlen, _Fdata + i * _fdist));
+    }
+}
@@ -0,0 +1,74 @@
+// ----------------------------------------------------------------------------
+//
+//  Copyright (C) 2010-2024 Fons Adriaensen <fons@linuxaudio.org>
+//    
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// ----------------------------------------------------------------------------
+
+
+
+#ifndef __RETBANK_H
+#define __RETBANK_H
+
+
+#include "retuner.h"
+
+
+// Runs up to NLANE Retuners in lockstep, with the read
+// indices, ratios and crossfade state of all channels
+// side by side so the interpolation can use one vector
+// lane per channel. Pitch estimates that are due in the
+// same fragment use batched FFTs. Input and the jump
+// decisions remain per channel.
+
+#ifdef __AVX__
+#define RETBANK_NLANE 8
+#else
+#define RETBANK_NLANE 4
+#endif
+
+
+class Retbank
+{
+public:
+
+    enum { NLANE = RETBANK_NLANE };
+
+    Retbank (void);
+    ~Retbank (void);
+
+    void init (Retuner *R);
+    void set_lanes (int nlane, Retuner **R);
+    int  process (int nfram, float **inp, float **out);
+
+private:
+
+    bool lockstep (void);
+    void procfrags (int nfram, int offs, float **inp, float **out, float **rsp);
+    void fragoutput (int k, int offs, float **out);
+    void analyse (int n, Retuner **R);
+
+    int              _nlane;
+    Retuner         *_lane [NLANE];
+    int              _fftlen;
+    int              _fdist;
+    float           *_Tdata;
+    fftwf_complex   *_Fdata;
+    fftwf_plan       _fwdplan [NLANE];
+    fftwf_plan       _invplan [NLANE];
+};
+
+
+#endif
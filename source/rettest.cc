@@ -0,0 +1,127 @@
+// ----------------------------------------------------------------------------
+//
+//  Copyright (C) 2010-2024 Fons Adriaensen <fons@linuxaudio.org>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// ----------------------------------------------------------------------------
+
+
+// Driver for 'make rettest'. Runs Retuners and channel groups
+// without JACK, with the analysis phases used by '-t' and a
+// fractional one, at period sizes that are not a multiple of
+// the fragment size. Built with the address sanitizer, so any
+// access outside the buffers aborts. The exit status is also
+// non-zero if the output is not finite, or if the channel
+// groups don't match the single channels.
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "retbank.h"
+
+
+enum { NLANE = Retbank::NLANE };
+
+
+static int test (int fsamp, int bsize, int nfram, float phase)
+{
+    int      c, i, j, n;
+    float    *inp [NLANE];
+    float    *out [NLANE];
+    float    *ref [NLANE];
+    float    *p, d, v;
+    double   ph;
+    Retuner  *R [NLANE];
+    Retuner  *S [NLANE];
+    Retbank  B;
+
+    // Two seconds of a vibrato tone per lane, the lanes
+    // with the phases as set by Jclient for '-t'.
+    n = 2 * fsamp;
+    for (c = 0; c < NLANE; c++)
+    {
+        inp [c] = new float [n];
+        out [c] = new float [n];
+        ref [c] = new float [n];
+        ph = 0;
+        for (i = 0; i < n; i++)
+        {
+            ph += 2 * M_PI * (150 + 37 * c) * (1 + 0.03 * sin (2 * M_PI * 3 * i / fsamp)) / fsamp;
+            inp [c][i] = 0.3f * sinf (ph);
+        }
+        R [c] = new Retuner (fsamp, bsize);
+        S [c] = new Retuner (fsamp, bsize);
+        R [c]->set_phase (phase + 0.25f * c);
+        S [c]->set_phase (phase + 0.25f * c);
+    }
+    B.init (S [0]);
+    B.set_lanes (NLANE, S);
+    for (i = 0; i + nfram <= n; i += nfram)
+    {
+        for (c = 0; c < NLANE; c++) R [c]->process (nfram, inp [c] + i, ref [c] + i);
+        float *ip [NLANE], *op [NLANE];
+        for (c = 0; c < NLANE; c++)
+        {
+            ip [c] = inp [c] + i;
+            op [c] = out [c] + i;
+        }
+        B.process (nfram, ip, op);
+    }
+    d = 0;
+    for (c = 0; c < NLANE; c++)
+    {
+        p = ref [c];
+        for (j = 0; j < i; j++)
+        {
+            if (! isfinite (p [j])) d = INFINITY;
+            v = fabsf (out [c][j] - p [j]);
+            if (v > d) d = v;
+        }
+        delete R [c];
+        delete S [c];
+        delete[] inp [c];
+        delete[] out [c];
+        delete[] ref [c];
+    }
+    printf ("fsamp %6d  block %4d  period %4d  phase %5.3f  maxdiff %g\n", fsamp, bsize, nfram, phase, d);
+    return d > 1e-6f;
+}
+
+
+int main (int ac, char *av [])
+{
+    int   i, j, k, r;
+
+    static const int    fsamp [3] = { 44100, 48000, 96000 };
+    static const int    nfram [5] = { 96, 480, 1000, 2048, 4096 };
+    static const float  phase [3] = { 0.0f, 0.3f, 0.618f };
+
+    r = 0;
+    for (i = 0; i < 3; i++)
+    {
+        for (j = 0; j < 5; j++)
+        {
+            for (k = 0; k < 3; k++)
+            {
+                r |= test (fsamp [i], 0, nfram [j], phase [k]);
+                if (nfram [j] > 1000) r |= test (fsamp [i], nfram [j], nfram [j], phase [k]);
+            }
+        }
+    }
+    printf (r ? "FAILED\n" : "PASSED\n");
+    return r;
+}
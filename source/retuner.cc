@@ -25,7 +25,7 @@
 #include "retuner.h"
 
 
-Retuner::Retuner (int fsamp) :
+Retuner::Retuner (int fsamp, int bsize) :
     _fsamp (fsamp),
     _refpitch (440.0f),
     _notebias (0.0f),
@@ -75,6 +75,13 @@ Retuner::Retuner (int fsamp) :
 
     // Various buffers
     _ipbuff = new float[_ipsize + 3];  // Resampled or filtered input
+    _rsbuff = 0;                       // Block mode staging buffer
+    _rssize = 0;
+    if (_upsamp && (bsize > _frsize))
+    {
+        _rssize = bsize;
+        _rsbuff = new float[2 * _rssize];
+    }
     _xffunc = new float[_frsize];      // Crossfade function
     _Twind = (float *) fftwf_malloc (_fftlen * sizeof (float)); // Window function 
     _Wcorr = (float *) fftwf_malloc (_fftlen * sizeof (float)); // Autocorrelation of window 
@@ -119,25 +126,52 @@ Retuner::Retuner (int fsamp) :
     for (i = 0; i < _fftlen; i++) _Wcorr [i] /= t;
 
     // Initialise all counters and other state.
-    _notebits = 0;
+    _anjump = 0;
+    _anwr = 0;
+    for (i = 0; i < ANRING; i++) _anseq [i] = 0;
     _lastnote = -1;
     _count = 0;
     _cycle = _frsize;
     _error = 0.0f;
+    _errval = 0.0f;
     _ratio = 1.0f;
     _xfade = false;
+    _jplan = false;
+    _xflen = _frsize;
+    _xfstep = 1;
+    _jumpcnt = 0;
+    _xfadecnt = 0;
+    _timing = false;
+    for (i = 0; i < NPHASE; i++) _phtime [i] = 0;
     _latency = _ipsize / 2;
     _ipindex = _latency;
     _frindex = 0;
     _frcount = 0;
     _rindex1 = 0;
     _rindex2 = 0;
+    _frtotal = 0;
+    _nanev = 0;
+    _freq = 0;
+    for (i = 0; i < 3; i++)
+    {
+        _ctlout [i] = 0;
+        _ctlval [i] = 0;
+        _ctlinc [i] = 0;
+    }
+    _ctlval [2] = 1.0f;
+    _reftarg = _refpitch;
+    _gaintarg = _corrgain;
+    _offstarg = _corroffs;
+    _smooth = false;
+    // Parameter smoothing, 20 ms time constant.
+    _smcoef = 1.0f - expf (-_frsize / (0.02f * _fsamp));
 }
 
 
 Retuner::~Retuner (void)
 {
     delete[] _ipbuff;
+    delete[] _rsbuff;
     delete[] _xffunc;
     fftwf_free (_Twind);
     fftwf_free (_Wcorr);
@@ -148,10 +182,74 @@ Retuner::~Retuner (void)
 }
 
 
+// Set the position in the 4-fragment analysis cycle, 'p' is
+// a fraction of the cycle, rounded down to whole fragments.
+// Retuners with different phases do their pitch estimates in
+// different periods, which spreads the load when many of them
+// run together. Must be called before the first process ().
+// Only _frcount is changed: the fragments must stay aligned
+// with the input buffer, which fraginput () wraps only at a
+// fragment end.
+//
+void Retuner::set_phase (float p)
+{
+    p -= floorf (p);
+    _frcount = (int)(4 * p) & 3;
+}
+
+
 int Retuner::process (int nfram, float *inp, float *out)
 {
-    int    i, k, fi, rt;
-    float  r1, r2, dr, u1, u2, v, ns, d1;
+    int        k;
+    float      *rsp;
+    long long  t = 0;
+
+    // In block mode the input for a large number of frames
+    // is upsampled in a single resampler call. Only that call
+    // is batched: the fragment loop copies from the staging
+    // buffer, and the interpolation, control outputs and jump
+    // decisions still run per fragment, exactly as they would
+    // for small process() calls. The input can't be upsampled
+    // directly into _ipbuff, as there is only about one
+    // fragment of free space ahead of the write index.
+
+    if (_rsbuff && (nfram > _frsize))
+    {
+        while (nfram)
+        {
+            k = (nfram < _rssize) ? nfram : _rssize;
+            if (_timing) t = nsec_time ();
+            rsp = blockinput (k, inp);
+            if (_timing) phtime (PH_RESAMP, t);
+            procfrags (k, inp, out, rsp);
+            nfram -= k;
+            inp += k;
+            out += k;
+        }
+    }
+    else procfrags (nfram, inp, out, 0);
+
+    return 0;
+}
+
+
+// Upsample 'k' frames into the block mode staging buffer.
+//
+float *Retuner::blockinput (int k, float *inp)
+{
+    _resampler.inp_count = k;
+    _resampler.inp_data = inp;
+    _resampler.out_count = 2 * k;
+    _resampler.out_data = _rsbuff;
+    _resampler.process ();
+    return _rsbuff;
+}
+
+
+void Retuner::procfrags (int nfram, float *inp, float *out, float *rsp)
+{
+    int        k;
+    long long  t = 0;
 
     // Pitch shifting is done by resampling the input at the
     // required ratio, and eventually jumping forward or back
@@ -163,171 +261,539 @@ int Retuner::process (int nfram, float *inp, float *out)
     // _fftsize = 16 * _frsize, the estimation window moves
     // by 1/4 of the FFT length.
 
-    fi = _frindex;  // Offset in current fragment.
-    r1 = _rindex1;  // First read index.
-    r2 = _rindex2;  // Second read index while crossfading. 
-
     // No assumptions are made about fragments being aligned
     // with process() calls, so we may be in the middle of
     // a fragment here. 
 
+    if (_timing) t = nsec_time ();
     while (nfram)
     {
         // Don't go past the end of the current fragment.
-        k = _frsize - fi;
+        k = _frsize - _frindex;
         if (nfram < k) k = nfram;
         nfram -= k;
+        rsp = fraginput (k, inp, rsp);
+        if (_timing) t = phtime (PH_RESAMP, t);
+        fragoutput (k, out);
+        ctloutput (k);
+        if (_timing) t = phtime (PH_INTERP, t);
+        inp += k;
+        out += k;
+        // If at end of fragment check for jump.
+        if (_frindex == _frsize)
+        {
+            fragend ();
+            if (_timing) t = phtime (PH_ANALYSE, t);
+        }
+    }
+}
+
+
+// Input for the current fragment, from the resampler or,
+// in block mode, from the staging buffer.
+//
+float *Retuner::fraginput (int k, float *inp, float *rsp)
+{
+    // At 44.1 and 48 kHz upsample by 2.
+    if (rsp)
+    {
+        // Already upsampled in block mode.
+        memcpy (_ipbuff + _ipindex, rsp, 2 * k * sizeof (float));
+        rsp += 2 * k;
+        _ipindex += 2 * k;
+    }
+    else if (_upsamp)
+    {
+        _resampler.inp_count = k;
+        _resampler.inp_data = inp;
+        _resampler.out_count = 2 * k;
+        _resampler.out_data = _ipbuff + _ipindex;
+        _resampler.process ();
+        _ipindex += 2 * k;
+    }
+    else
+    {
+        memcpy (_ipbuff + _ipindex, inp, k * sizeof (float));
+        _ipindex += k;
+    }
+
+    // Extra samples for interpolation.
+    _ipbuff [_ipsize + 0] = _ipbuff [0];
+    _ipbuff [_ipsize + 1] = _ipbuff [1];
+    _ipbuff [_ipsize + 2] = _ipbuff [2];
+    if (_ipindex == _ipsize) _ipindex = 0;
+    _frtotal += k;
+    return rsp;
+}
+
 
-        // At 44.1 and 48 kHz upsample by 2.
-        if (_upsamp)
+// Output for the current fragment.
+//
+void Retuner::fragoutput (int k, float *out)
+{
+    int    n;
+    float  dr;
+
+    dr = _ratio;
+    if (_upsamp) dr *= 2;
+    if (_xfade)
+    {
+        // Interpolate and crossfade. The crossfade may
+        // be shorter than a fragment, see planjump().
+        n = _xflen - _frindex;
+        if (n > k) n = k;
+        k -= n;
+        interp2 (out, _rindex1, _rindex2, dr, _xffunc + _xfstep * _frindex, n);
+        out += n;
+        _frindex += n;
+        if (_frindex == _xflen)
         {
-            _resampler.inp_count = k;
-            _resampler.inp_data = inp;
-            _resampler.out_count = 2 * k;
-            _resampler.out_data = _ipbuff + _ipindex;
-            _resampler.process ();
-            _ipindex += 2 * k;
+            // Crossfade completed, continue from the
+            // second read index.
+            _rindex1 = _rindex2;
+            _xfade = false;
         }
-	else
-	{
-            memcpy (_ipbuff + _ipindex, inp, k * sizeof (float));
-            _ipindex += k;
-	}
-
-        // Extra samples for interpolation.
-        _ipbuff [_ipsize + 0] = _ipbuff [0];
-        _ipbuff [_ipsize + 1] = _ipbuff [1];
-        _ipbuff [_ipsize + 2] = _ipbuff [2];
-        inp += k;
-        if (_ipindex == _ipsize) _ipindex = 0;
+    }
+    if (!_xfade)
+    {
+        // Interpolation only.
+        interp1 (out, _rindex1, dr, k);
+        _frindex += k;
+    }
+}
+
+
+// Control outputs. At the start of each fragment a linear
+// ramp is set from the current output values to those
+// determined at the end of the previous fragment.
+//
+void Retuner::ctloutput (int k)
+{
+    int    i, j;
+    float  v, d, *p;
+
+    if (! _ctlout [0]) return;
+    if (_frindex == k)
+    {
+        _ctlinc [0] = (_freq - _ctlval [0]) / _frsize;
+        _ctlinc [1] = (12.0f * _error - _ctlval [1]) / _frsize;
+        _ctlinc [2] = (_ratio - _ctlval [2]) / _frsize;
+    }
+    for (i = 0; i < 3; i++)
+    {
+        p = _ctlout [i];
+        v = _ctlval [i];
+        d = _ctlinc [i];
+        for (j = 0; j < k; j++)
+        {
+            v += d;
+            p [j] = v;
+        }
+        _ctlval [i] = v;
+        _ctlout [i] = p + k;
+    }
+}
+
+
+// End of fragment: new pitch estimate if due, and
+// decide on a jump for the next fragment.
+//
+void Retuner::fragend (void)
+{
+    // Estimate the pitch every 4th fragment.
+    if (++_frcount == 4)
+    {
+        _frcount = 0;
+        newcycle (findcycle ());
+    }
+    fragjump ();
+}
+
+
+// Update the pitch error and resampling ratio
+// from a new pitch estimate 'v', zero if none.
+//
+void Retuner::newcycle (float v)
+{
+    if (v)
+    {
+        // If the pitch estimate succeeds, find the
+        // nearest note and required resampling ratio.
+        _count = 0;
+        _cycle = v;
+        _freq = _fsamp / v;
+        finderror ();
+    }
+    else if (++_count > 5)
+    {
+        // If the pitch estimate fails, the current
+        // ratio is kept for 5 fragments. After that
+        // the signal is considered unvoiced and the
+        // pitch error is reset.
+        _count = 5;
+        _cycle = _frsize;
+        _freq = 0;
+        _error = 0;
+    }
+    else if (_count == 2)
+    {
+        // Bias is removed after two unvoiced fragments.
+        _lastnote = -1;
+    }
+    
+    _ratio = powf (2.0f, _corroffs / 12.0f - _error * _corrgain);
+
+    // Record voiced estimates, and unvoiced after the hold time.
+    if ((v || (_count == 5)) && (_nanev < MAXANEV))
+    {
+        _anev [_nanev].time = _frtotal - 1;
+        _anev [_nanev].freq = v ? _fsamp / v : 0;
+        _anev [_nanev].error = 12.0f * _error;
+        _nanev++;
+    }
+    _errval = 12.0f * _error;
+    anrecord (v);
+}
+
+
+void Retuner::anrecord (float v)
+{
+    unsigned int  w, k;
+    Anrecord      *R;
+
+    // Add a record to the ring, overwriting the oldest one.
+    // The sequence number of the slot is odd while it is
+    // being written, and 2 * (index + 1) when complete.
+    w = _anwr.load (std::memory_order_relaxed);
+    k = w & (ANRING - 1);
+    _anseq [k].store (2 * w + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence (std::memory_order_release);
+    R = _anring + k;
+    R->time = _frtotal - 1;
+    R->period = v;
+    R->note = v ? _lastnote : -1;
+    R->error = 12.0f * _error;
+    R->ratio = _ratio;
+    R->voiced = v != 0;
+    R->jump = _jumpcnt != _anjump;
+    _anjump = _jumpcnt;
+    _anseq [k].store (2 * w + 2, std::memory_order_release);
+    _anwr.store (w + 1, std::memory_order_release);
+}
+
+
+bool Retuner::get_anrecord (unsigned int *cursor, Anrecord *R)
+{
+    unsigned int  r, w, k, s;
+
+    // A cursor more than the ring size behind, or ahead
+    // as it may be after the Retuner was replaced, is
+    // moved to the oldest record still available.
+    w = _anwr.load (std::memory_order_acquire);
+    r = *cursor;
+    if (w - r > ANRING) r = (w > ANRING) ? w - ANRING : 0;
+    while (r != w)
+    {
+        k = r & (ANRING - 1);
+        s = _anseq [k].load (std::memory_order_acquire);
+        *R = _anring [k];
+        std::atomic_thread_fence (std::memory_order_acquire);
+        if ((s == 2 * r + 2) && (_anseq [k].load (std::memory_order_relaxed) == s))
+        {
+            *cursor = r + 1;
+            return true;
+        }
+        r++;
+    }
+    *cursor = r;
+    return false;
+}
 
-        // Process available samples.
-        dr = _ratio;
-        if (_upsamp) dr *= 2;
-        if (_xfade)
+
+void Retuner::fragjump (void)
+{
+    int    rt;
+    float  r1, r2, dr, ns, d1;
+
+    r1 = _rindex1;
+    r2 = _rindex2;
+    _frindex = 0;
+    if (_smooth) smooth ();
+
+    // If the previous fragment was crossfading,
+    // the end of the new fragment that was faded
+    // in becomes the current read position.
+    if (_xfade) r1 = r2;
+
+    // A jump must correspond to an integer number
+    // of pitch periods, and to minimise the number
+    // the jumps at low periods we also require it
+    // to be at least one fragment.
+
+    dr = _cycle * (int)(ceilf (_frsize / _cycle));
+    if (_upsamp) dr *= 2;
+
+    // We try to keep the read index as close as
+    // possible to the write index minus the latency.
+    // Additionally, to make sure we don't read past
+    // the end of the input we need _frsize * _ratio
+    // samples in the next period, and maybe up to
+    // _frsize * 1.6 in the following one, where
+    // we will have _frsize more input. Combining
+    // these two conditions, if we don't jump we
+    // must have at least this number of samples
+    // available:
+
+    ns = _frsize * 2.2f + 3;
+
+    // rt = target for read index to be close to.
+    rt = _ipindex -_latency;
+    if (rt < 0) rt += _ipsize;
+
+    // d1 = distance to target reading index.
+    d1 = r1 - rt;
+    if      (d1 >  _ipsize / 2) d1 -= _ipsize;
+    else if (d1 < -_ipsize / 2) d1 += _ipsize;
+
+    // Check for crossfade.
+    _xfade = false;
+    if ((d1 > dr / 2) || (d1 + ns >= _latency))
+    {
+	_xfade = true;
+	dr = -dr;
+    }
+    else if (d1 < -dr / 2)
+    {
+	_xfade = true;
+    }
+    if (_xfade)
+    {
+	// Either use the minimal jump and a full
+	// fragment crossfade, or let the planner
+	// select the jump and crossfade length.
+	if (_jplan) dr = planjump (r1, d1, dr, ns);
+	else _xflen = _frsize;
+	_xfstep = _frsize / _xflen;
+	r2 = r1 + dr;
+	if (r2 < 0) r2 += _ipsize;
+	else if (r2 >= _ipsize) r2 -= _ipsize;
+	_jumpcnt++;
+	_xfadecnt += _xflen;
+    }
+
+    _rindex1 = r1;
+    _rindex2 = r2;
+}
+
+
+// Changes of the parameters that determine the resampling
+// ratio are smoothed, and the ratio updated, once per
+// fragment until the new values are reached.
+//
+void Retuner::smooth (void)
+{
+    float d;
+
+    _smooth = false;
+    d = _reftarg - _refpitch;
+    if (fabsf (d) > 1e-3f)
+    {
+        _refpitch += _smcoef * d;
+        _smooth = true;
+    }
+    else _refpitch = _reftarg;
+    d = _gaintarg - _corrgain;
+    if (fabsf (d) > 1e-4f)
+    {
+        _corrgain += _smcoef * d;
+        _smooth = true;
+    }
+    else _corrgain = _gaintarg;
+    d = _offstarg - _corroffs;
+    if (fabsf (d) > 1e-4f)
+    {
+        _corroffs += _smcoef * d;
+        _smooth = true;
+    }
+    else _corroffs = _offstarg;
+    _ratio = powf (2.0f, _corroffs / 12.0f - _error * _corrgain);
+}
+
+
+// The interpolation loops test for wraparound of the read
+// index only once per run of samples that can't reach the
+// end of the input buffer, keeping the inner loops free
+// of branches. The sequence of read indices is the same
+// as with a test on every sample.
+//
+int Retuner::runlen (float r, float dr, int n)
+{
+    int m;
+
+    // Margin of two steps for rounding errors.
+    m = (int)((_ipsize - r) / dr) - 2;
+    return (m < n) ? m : n;
+}
+
+
+void Retuner::interp1 (float *out, float &r, float dr, int n)
+{
+    int    i, m;
+    float  a;
+
+    a = r;
+    while (n)
+    {
+        m = runlen (a, dr, n);
+        if (m > 0)
         {
-            // Interpolate and crossfade.
-            while (k--)
+            n -= m;
+            while (m--)
             {
-                i = (int) r1;
-                u1 = cubic (_ipbuff + i, r1 - i);
-                i = (int) r2;
-                u2 = cubic (_ipbuff + i, r2 - i);
-                v = _xffunc [fi++];
-                *out++ = (1 - v) * u1 + v * u2;
-                r1 += dr;
-                if (r1 >= _ipsize) r1 -= _ipsize;
-                r2 += dr;
-                if (r2 >= _ipsize) r2 -= _ipsize;
+                i = (int) a;
+                *out++ = cubic (_ipbuff + i, a - i);
+                a += dr;
             }
         }
         else
         {
-            // Interpolation only.
-            fi += k;
-            while (k--)
-            {
-                i = (int) r1;
-                *out++ = cubic (_ipbuff + i, r1 - i);
-                r1 += dr;
-                if (r1 >= _ipsize) r1 -= _ipsize;
-            }
+            i = (int) a;
+            *out++ = cubic (_ipbuff + i, a - i);
+            a += dr;
+            if (a >= _ipsize) a -= _ipsize;
+            n--;
         }
- 
-        // If at end of fragment check for jump.
-        if (fi == _frsize) 
+    }
+    r = a;
+}
+
+
+void Retuner::interp2 (float *out, float &r1, float &r2, float dr, const float *xf, int n)
+{
+    int    i, j, m;
+    float  a, b, u1, u2, v;
+
+    a = r1;
+    b = r2;
+    j = 0;
+    while (n)
+    {
+        m = runlen ((a > b) ? a : b, dr, n);
+        if (m > 0)
         {
-            fi = 0;
-            // Estimate the pitch every 4th fragment.
-            if (++_frcount == 4)
+            n -= m;
+            while (m--)
             {
-                _frcount = 0;
-                v = findcycle ();
-                if (v)
-                {
-                    // If the pitch estimate succeeds, find the
-                    // nearest note and required resampling ratio.
-                    _count = 0;
-                    _cycle = v;
-                    finderror ();
-                }
-                else if (++_count > 5)
-                {
-                    // If the pitch estimate fails, the current
-                    // ratio is kept for 5 fragments. After that
-                    // the signal is considered unvoiced and the
-                    // pitch error is reset.
-                    _count = 5;
-                    _cycle = _frsize;
-                    _error = 0;
-                }
-                else if (_count == 2)
-                {
-                    // Bias is removed after two unvoiced fragments.
-                    _lastnote = -1;
-                }
-                
-                _ratio = powf (2.0f, _corroffs / 12.0f - _error * _corrgain);
+                i = (int) a;
+                u1 = cubic (_ipbuff + i, a - i);
+                i = (int) b;
+                u2 = cubic (_ipbuff + i, b - i);
+                v = xf [j];
+                j += _xfstep;
+                *out++ = (1 - v) * u1 + v * u2;
+                a += dr;
+                b += dr;
             }
+        }
+        else
+        {
+            i = (int) a;
+            u1 = cubic (_ipbuff + i, a - i);
+            i = (int) b;
+            u2 = cubic (_ipbuff + i, b - i);
+            v = xf [j];
+            j += _xfstep;
+            *out++ = (1 - v) * u1 + v * u2;
+            a += dr;
+            if (a >= _ipsize) a -= _ipsize;
+            b += dr;
+            if (b >= _ipsize) b -= _ipsize;
+            n--;
+        }
+    }
+    r1 = a;
+    r2 = b;
+}
 
-            // If the previous fragment was crossfading,
-            // the end of the new fragment that was faded
-            // in becomes the current read position.
-            if (_xfade) r1 = r2;
-
-            // A jump must correspond to an integer number
-            // of pitch periods, and to minimise the number
-	    // the jumps at low periods we also require it
-	    // to be at least one fragment.
-
-            dr = _cycle * (int)(ceilf (_frsize / _cycle));
-            if (_upsamp) dr *= 2;
-
-            // We try to keep the read index as close as
-	    // possible to the write index minus the latency.
-	    // Additionally, to make sure we don't read past
-	    // the end of the input we need _frsize * _ratio
-	    // samples in the next period, and maybe up to
-	    // _frsize * 1.6 in the following one, where
-	    // we will have _frsize more input. Combining
-	    // these two conditions, if we don't jump we
-	    // must have at least this number of samples
-	    // available:
-
-	    ns = _frsize * 2.2f + 3;
-
-	    // rt = target for read index to be close to.
-	    rt = _ipindex -_latency;
-	    if (rt < 0) rt += _ipsize;
-
-	    // d1 = distance to target reading index.
-	    d1 = r1 - rt;
-	    if      (d1 >  _ipsize / 2) d1 -= _ipsize;
-	    else if (d1 < -_ipsize / 2) d1 += _ipsize;
-
-	    // Check for crossfade.
-	    _xfade = false;
-	    if ((d1 > dr / 2) || (d1 + ns >= _latency))
-	    {
-		_xfade = true;
-		r2 = r1 - dr;
-		if (r2 < 0) r2 += _ipsize;
-	    }
-	    else if (d1 < -dr / 2)
-	    {
-		_xfade = true;
-		r2 = r1 + dr;
-		if (r2 >= _ipsize) r2 -= _ipsize;
-	    }
+
+// Select a jump among a few candidate multiples of the
+// pitch period, all in the direction of the minimal jump
+// 'dj'. Each candidate is scored by how well the signal
+// at the new read position matches the one at the current
+// position, with a small penalty for ending up far from
+// the target. A strong match allows a shorter crossfade.
+// Returns the jump distance and sets _xflen.
+//
+float Retuner::planjump (float r1, float d1, float dj, float ns)
+{
+    int    n, m;
+    float  c, d, dr, r2, q, s, qm, sm, dm;
+
+    c = _upsamp ? 2 * _cycle : _cycle;
+    if (dj < 0) c = -c;
+    dr = _ratio;
+    if (_upsamp) dr *= 2;
+
+    // Number of points to correlate, limited by the input
+    // available ahead of the current read index.
+    m = (int)((_latency - d1 - 4) / (dr * _frsize / 32));
+    if (m > 32) m = 32;
+
+    qm = sm = -1e30f;
+    dm = dj;
+    for (n = 0; n < 3; n++)
+    {
+        d = d1 + dj + n * c;
+        // The minimal jump is always acceptable, the others
+        // must not get too close to the write index or too
+        // far behind it.
+        if (n && ((d + ns >= _latency) || (d < -_latency / 2))) break;
+        if (m < 4) break;
+        r2 = r1 + dj + n * c;
+        if (r2 < 0) r2 += _ipsize;
+        else if (r2 >= _ipsize) r2 -= _ipsize;
+        q = matchjump (r1, r2, dr, m);
+        s = q - fabsf (d) / _latency;
+        if (s > sm)
+        {
+            sm = s;
+            qm = q;
+            dm = dj + n * c;
         }
     }
 
-    // Save local state.
-    _frindex = fi;
-    _rindex1 = r1;
-    _rindex2 = r2;
+    if      (qm > 0.9f) _xflen = _frsize / 4;
+    else if (qm > 0.7f) _xflen = _frsize / 2;
+    else                _xflen = _frsize;
+    return dm;
+}
 
-    return 0;
+
+// Normalised correlation of the signals that would be read
+// from r1 and r2, using n points spread over one fragment.
+//
+float Retuner::matchjump (float r1, float r2, float dr, int n)
+{
+    int    i;
+    float  u1, u2, s11, s12, s22;
+
+    dr *= _frsize / 32;
+    s11 = s12 = s22 = 1e-20f;
+    while (n--)
+    {
+        i = (int) r1;
+        u1 = cubic (_ipbuff + i, r1 - i);
+        i = (int) r2;
+        u2 = cubic (_ipbuff + i, r2 - i);
+        s11 += u1 * u1;
+        s12 += u1 * u2;
+        s22 += u2 * u2;
+        r1 += dr;
+        if (r1 >= _ipsize) r1 -= _ipsize;
+        r2 += dr;
+        if (r2 >= _ipsize) r2 -= _ipsize;
+    }
+    return s12 / sqrtf (s11 * s22);
 }
 
 
@@ -358,41 +824,66 @@ float findpeak (float *Y, int k, int n)
 //
 float Retuner::findcycle (void)
 {
-    int    d, h, i, j, k;
-    float  f, x, y, z, m, di, i1, im, y1, ym, a1, am; 
+    anwindow (_Tdata);
+    fftwf_execute_dft_r2c (_fwdplan, _Tdata, _Fdata);    
+    anpower (_Fdata);
+    // Inverse FFT of power spectrum is autocorrelation.
+    fftwf_execute_dft_c2r (_invplan, _Fdata, _Tdata);    
+    return anpeaks (_Tdata, _Fdata);
+}
+
+
+// The steps of findcycle () between the FFTs, on buffers
+// that may be shared with other Retuners, see Retbank.
+//
+void Retuner::anwindow (float *T)
+{
+    int  d, i, j, k;
 
     d = _upsamp ? 2 : 1;
-    h = _fftlen / 2;
     j = _ipindex;
     k = _ipsize - 1;
 
     // Apply window (includes FFT scale factor).
     for (i = 0; i < _fftlen; i++)
     {
-        _Tdata [i] = _Twind [i] * _ipbuff [j & k];
+        T [i] = _Twind [i] * _ipbuff [j & k];
         j += d;
     }
-    fftwf_execute_dft_r2c (_fwdplan, _Tdata, _Fdata);    
+}
+
+
+void Retuner::anpower (fftwf_complex *F)
+{
+    int    h, i;
+    float  f, m, x, y;
 
     // Power spectrum, attenuated above 8 kHz.
+    h = _fftlen / 2;
     f = _fsamp / (_fftlen * 8e3f);
     for (i = 0; i < h; i++)
     {
-        x = _Fdata [i][0];
-        y = _Fdata [i][1];
+        x = F [i][0];
+        y = F [i][1];
         m = i * f;
-        _Fdata [i][0] = (x * x + y * y) / (1 + m * m);
-        _Fdata [i][1] = 0;
+        F [i][0] = (x * x + y * y) / (1 + m * m);
+        F [i][1] = 0;
     }
-    _Fdata [h][0] = 0;
-    _Fdata [h][1] = 0;
+    F [h][0] = 0;
+    F [h][1] = 0;
+}
 
-    // Inverse FFT of power spectrum is autocorrelation.
-    fftwf_execute_dft_c2r (_invplan, _Fdata, _Tdata);    
+
+float Retuner::anpeaks (float *T, fftwf_complex *F)
+{
+    int    h, i, j;
+    float  x, y, z, m, di, i1, im, y1, ym, a1, am; 
+
+    h = _fftlen / 2;
 
     // Normalise by total power, and apply window correction.
-    m = _Tdata [0] + 1e-10f;
-    for (i = 0; i < h; i++) _Tdata [i] /= (m * _Wcorr [i]);
+    m = T [0] + 1e-10f;
+    for (i = 0; i < h; i++) T [i] /= (m * _Wcorr [i]);
     // Ensure m = 1 for a full scale sine wave, so
     // we can compare to spectrum values in Fdata.
     m /= 3.0f; 
@@ -405,7 +896,7 @@ float Retuner::findcycle (void)
     
     // Find first zero crossing.
     i = 0;
-    while ((i < _ifmax / 2) && (_Tdata [i] > 0)) i++;
+    while ((i < _ifmax / 2) && (T [i] > 0)) i++;
     if (i <= _ifmin / 2)
     {
 	// Looks like noise, assume unvoiced. 
@@ -417,18 +908,18 @@ float Retuner::findcycle (void)
     ym = 0.3f; // Autocorrelation.
     am = 0.0f; // Relative power.
 
-    y = _Tdata [i-1];
-    z = _Tdata [i];
+    y = T [i-1];
+    z = T [i];
     while (i < _ifmax)
     {
         x = y;
 	y = z;
-	z = _Tdata [i + 1];
+	z = T [i + 1];
         if ((y > ym) && (y > x) && (y > z))
 	{		    
 	    // Find real peak position, using 10 samples
 	    // before and after.
-            di = findpeak (_Tdata, i, _ifmin / 4);
+            di = findpeak (T, i, _ifmin / 4);
             if (fabs (di) > _ifmin / 4)
 	    {
 		// Unreliable peak, reject.
@@ -440,9 +931,9 @@ float Retuner::findcycle (void)
 	    // Corresponding frequency bin.
 	    j = (int)(_fftlen / i1 + 0.5f); 
 	    // Real peak value.
-            y1 = _Tdata [(int)(i1 + 0.5f)];
+            y1 = T [(int)(i1 + 0.5f)];
 	    // Relative power in frequency bin.
-            a1 = _Fdata [j][0] / m;
+            a1 = F [j][0] / m;
 
 	    if (a1 < 1e-4f)
 	    {
@@ -517,9 +1008,6 @@ void Retuner::finderror (void)
         _error = dm;
         _lastnote = im;
     }
-
-    // For display only.
-    _notebits |= 1 << im;
 }
 
 
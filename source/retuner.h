@@ -22,22 +22,70 @@
 #define __RETUNER_H
 
 
+#include <time.h>
+#include <atomic>
 #include <fftw3.h>
 #include <zita-resampler/resampler.h>
 
 
+// Monotonic time in nanoseconds, used for the phase timing.
+
+inline long long nsec_time (void)
+{
+    timespec  T;
+
+    clock_gettime (CLOCK_MONOTONIC, &T);
+    return T.tv_sec * 1000000000LL + T.tv_nsec;
+}
+
+
+// Result of a pitch estimate, for use outside the Retuner.
+// 'time' is the input frame at which it was made, counting
+// from the first frame processed, 'freq' is the detected
+// frequency in Hz, zero if the signal became unvoiced.
+
+struct Anevent
+{
+    unsigned int  time;
+    float         freq;
+    float         error;
+};
+
+
+// Record of every pitch estimate, for display and logging.
+// 'time' is as for Anevent, 'period' is in samples at the
+// external rate and 'note' is the note index, both zero or
+// -1 if not voiced. 'jump' is set if there was any jump
+// since the previous record.
+
+struct Anrecord
+{
+    unsigned int  time;
+    float         period;
+    int           note;
+    float         error;
+    float         ratio;
+    bool          voiced;
+    bool          jump;
+};
+
+
 class Retuner
 {
 public:
 
-    Retuner (int fsamp);
+    enum { MAXANEV = 16, ANRING = 64 };
+    enum { PH_RESAMP, PH_INTERP, PH_ANALYSE, NPHASE };
+
+    Retuner (int fsamp, int bsize = 0);
     ~Retuner (void);
 
     int process (int nfram, float *inp, float *out);
 
     void set_refpitch (float v)
     {
-        _refpitch = v;
+        _reftarg = v;
+        _smooth = true;
     }
 
     void set_notebias (float v)
@@ -52,12 +100,14 @@ public:
 
     void set_corrgain (float v)
     {
-        _corrgain = v;
+        _gaintarg = v;
+        _smooth = true;
     }
 
     void set_corroffs (float v)
     {
-        _corroffs = v;
+        _offstarg = v;
+        _smooth = true;
     }
 
     void set_notemask (int k)
@@ -69,28 +119,103 @@ public:
     {
 	_latency = _ipsize / (on ? 4 : 2);
     }
-   
-    int get_noteset (void)
+
+    // Nominal delay from input to output with the given
+    // LLAT state, in samples at the external sample rate.
+    // The interpolation reads one sample ahead, the
+    // resampler adds half its filter length.
+    int get_latency (bool lowlat) const
     {
-        int k;
+        int d = _ipsize / (lowlat ? 4 : 2) - 1;
+        return _upsamp ? (d + _resampler.inpsize ()) / 2 : d;
+    }
 
-        k = _notebits;
-        _notebits = 0;
-        return k;
+    void set_jumpplan (bool on)
+    {
+        _jplan = on;
     }
 
+    void set_phase (float p);
+
+    // Buffers for the detected frequency, the error in
+    // semitones and the resampling ratio, filled by the
+    // next process () calls, or zero for none.
+    void set_ctlout (float **p)
+    {
+        _ctlout [0] = p [0];
+        _ctlout [1] = p [1];
+        _ctlout [2] = p [2];
+    }
+   
     float get_error (void)
     {
-        return 12.0f * _error;
+        return _errval;
     }
 
+    // Pitch estimates made since the last clr_anevents (),
+    // at most MAXANEV, and the input frame count.
+    int get_nanev (void) const { return _nanev; }
+    const Anevent *get_anevent (int i) const { return _anev + i; }
+    void clr_anevents (void) { _nanev = 0; }
+    unsigned int get_frtotal (void) const { return _frtotal; }
+
+    // Reads the Anrecord at '*cursor' and advances it, returns
+    // false if there is none. Each reader has its own cursor,
+    // starting at zero. The writer never waits, records that
+    // have been overwritten before being read are skipped.
+    bool get_anrecord (unsigned int *cursor, Anrecord *R);
+
+    // Time spent in the resampler, the interpolation and the
+    // analysis, in ns, is added to 't' and restarted from zero.
+    // Counted only when enabled.
+    void set_timing (bool on) { _timing = on; }
+    void get_phtime (long long *t)
+    {
+        for (int k = 0; k < NPHASE; k++)
+        {
+            t [k] += _phtime [k];
+            _phtime [k] = 0;
+        }
+    }
+
+    // Running totals, the caller computes rates.
+    unsigned int get_jumpcount (void) const { return _jumpcnt; }
+    unsigned int get_xfadecount (void) const { return _xfadecnt; }
+
 
 private:
 
+    friend class Retbank;
+
+    float *blockinput (int k, float *inp);
+    void  procfrags (int nfram, float *inp, float *out, float *rsp);
+    float *fraginput (int k, float *inp, float *rsp);
+    void  fragoutput (int k, float *out);
+    void  ctloutput (int k);
+    long long phtime (int k, long long t)
+    {
+        long long u = nsec_time ();
+        _phtime [k] += u - t;
+        return u;
+    }
+    void  fragend (void);
+    void  newcycle (float v);
+    void  anrecord (float v);
+    void  fragjump (void);
+    void  smooth (void);
+    int   runlen (float r, float dr, int n);
+    void  interp1 (float *out, float &r, float dr, int n);
+    void  interp2 (float *out, float &r1, float &r2, float dr, const float *xf, int n);
     float findcycle (void);
+    void  anwindow (float *T);
+    void  anpower (fftwf_complex *F);
+    float anpeaks (float *T, fftwf_complex *F);
     void  finderror (void);
+    float planjump (float r1, float d1, float dj, float ns);
+    float matchjump (float r1, float r2, float dr, int n);
     float cubic (float *v, float a);
 
+    // Set up by the constructor, read only afterwards.
     int              _fsamp;
     int              _ifmin;
     int              _ifmax;
@@ -98,35 +223,73 @@ private:
     int              _fftlen;
     int              _ipsize;
     int              _frsize;
-    int              _latency;
-    int              _ipindex;
-    int              _frindex;
-    int              _frcount;
+    float           *_ipbuff;
+    float           *_rsbuff;
+    int              _rssize;
+    float           *_xffunc;
+    float           *_Twind;
+    float           *_Wcorr;
+    float           *_Tdata;
+    fftwf_complex   *_Fdata;
+    fftwf_plan       _fwdplan;
+    fftwf_plan       _invplan;
+
+    // Parameters and their smoothing. The blocks below each
+    // start on a new cache line, which keeps the members used
+    // only by the processing apart from those other threads
+    // read. This is a layout choice, no effect on the callback
+    // time has been measured.
+    alignas (64)
     float            _refpitch;
     float            _notebias;
     float            _corrfilt; 
     float            _corrgain;
     float            _corroffs;
     int              _notemask;
-    int              _notebits;
+    float            _reftarg;
+    float            _gaintarg;
+    float            _offstarg;
+    float            _smcoef;
+    bool             _smooth;
+    bool             _jplan;
+    bool             _timing;
+    int              _latency;
+    float           *_ctlout [3];
+
+    // Processing state.
+    alignas (64)
+    int              _ipindex;
+    int              _frindex;
+    int              _frcount;
+    float            _rindex1;
+    float            _rindex2;
+    float            _ratio;
+    bool             _xfade;
+    int              _xflen;
+    int              _xfstep;
     int              _lastnote;
     int              _count;
     float            _cycle;
     float            _error;
-    float            _ratio;
     float            _phase;
-    bool             _xfade;
-    float            _rindex1;
-    float            _rindex2;
-    float           *_ipbuff;
-    float           *_xffunc;
-    float           *_Twind;
-    float           *_Wcorr;
-    float           *_Tdata;
-    fftwf_complex   *_Fdata;
-    fftwf_plan       _fwdplan;
-    fftwf_plan       _invplan;
+    float            _freq;
+    float            _ctlval [3];
+    float            _ctlinc [3];
     Resampler        _resampler;
+    unsigned int     _frtotal;
+    unsigned int     _anjump;
+    long long        _phtime [NPHASE];
+
+    // Results, read by other threads.
+    alignas (64)
+    float            _errval;
+    unsigned int     _jumpcnt;
+    unsigned int     _xfadecnt;
+    int              _nanev;
+    Anevent          _anev [MAXANEV];
+    std::atomic<unsigned int> _anwr;
+    std::atomic<unsigned int> _anseq [ANRING];
+    Anrecord         _anring [ANRING];
 };
 
 
@@ -70,6 +70,8 @@ public:
 
     static void init (X_display *disp);
     static void fini (void);
+    static int  keymod (void) { return _keymod; }
+    static int  button (void) { return _button; }
 
     static int  _wb_up;
     static int  _wb_dn;
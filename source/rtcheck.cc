@@ -0,0 +1,204 @@
+// ----------------------------------------------------------------------------
+//
+//  Copyright (C) 2010-2024 Fons Adriaensen <fons@linuxaudio.org>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// ----------------------------------------------------------------------------
+
+
+#ifdef RTCHECK
+
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <execinfo.h>
+#include <atomic>
+#include "rtcheck.h"
+
+
+// The allocator is replaced by wrappers around the glibc
+// internal entry points, which avoids the recursion that
+// dlsym () would cause. The other functions are found
+// with dlsym (RTLD_NEXT).
+
+extern "C"
+{
+    void *__libc_malloc (size_t n);
+    void *__libc_calloc (size_t n, size_t s);
+    void *__libc_realloc (void *p, size_t n);
+    void *__libc_memalign (size_t a, size_t n);
+    void  __libc_free (void *p);
+}
+
+
+enum { RC_MALLOC, RC_FREE, RC_MUTEX, RC_WRITE, NCHECK, MAXTRACE = 20 };
+
+static const char *checkname [NCHECK] = { "malloc", "free", "pthread_mutex_lock", "write" };
+
+static std::atomic<unsigned int> checkcnt [NCHECK];
+static std::atomic<unsigned int> tracecnt (0);
+static bool  abort_on_error = false;
+static int (*real_mutex_lock)(pthread_mutex_t *) = 0;
+static ssize_t (*real_write)(int, const void *, size_t) = 0;
+
+thread_local int Rtscope::_depth = 0;
+
+
+static void violation (int k)
+{
+    int    d, n;
+    void  *bt [32];
+
+    // Count the call, and for the first few also print a
+    // backtrace. Checking is suspended meanwhile as printing
+    // will itself call write () and maybe malloc ().
+
+    checkcnt [k]++;
+    if (!abort_on_error && (tracecnt++ >= MAXTRACE)) return;
+    d = Rtscope::_depth;
+    Rtscope::_depth = 0;
+    fprintf (stderr, "RTCHECK: %s called in RT context\n", checkname [k]);
+    n = backtrace (bt, 32);
+    backtrace_symbols_fd (bt, n, 2);
+    if (abort_on_error) abort ();
+    Rtscope::_depth = d;
+}
+
+
+void rtcheck_init (void)
+{
+    void  *bt [4];
+    char  *p;
+
+    // Resolve the real functions and call backtrace () once,
+    // the first call loads libgcc and allocates.
+
+    real_mutex_lock = (int (*)(pthread_mutex_t *)) dlsym (RTLD_NEXT, "pthread_mutex_lock");
+    real_write = (ssize_t (*)(int, const void *, size_t)) dlsym (RTLD_NEXT, "write");
+    backtrace (bt, 4);
+    p = getenv ("ZITA_RTCHECK");
+    abort_on_error = p && !strcmp (p, "abort");
+    fprintf (stderr, "RTCHECK enabled%s.\n", abort_on_error ? ", aborting on error" : "");
+}
+
+
+void rtcheck_report (void)
+{
+    int  k;
+
+    printf ("RTCHECK calls in RT context:\n");
+    for (k = 0; k < NCHECK; k++)
+    {
+        printf ("  %-20s %8u\n", checkname [k], checkcnt [k].load ());
+    }
+}
+
+
+unsigned int rtcheck_count (void)
+{
+    int           k;
+    unsigned int  n;
+
+    for (k = n = 0; k < NCHECK; k++) n += checkcnt [k].load ();
+    return n;
+}
+
+
+extern "C"
+{
+
+void *malloc (size_t n)
+{
+    if (Rtscope::_depth) violation (RC_MALLOC);
+    return __libc_malloc (n);
+}
+
+
+void *calloc (size_t n, size_t s)
+{
+    if (Rtscope::_depth) violation (RC_MALLOC);
+    return __libc_calloc (n, s);
+}
+
+
+void *realloc (void *p, size_t n)
+{
+    if (Rtscope::_depth) violation (RC_MALLOC);
+    return __libc_realloc (p, n);
+}
+
+
+void *memalign (size_t a, size_t n)
+{
+    if (Rtscope::_depth) violation (RC_MALLOC);
+    return __libc_memalign (a, n);
+}
+
+
+void *aligned_alloc (size_t a, size_t n)
+{
+    if (Rtscope::_depth) violation (RC_MALLOC);
+    return __libc_memalign (a, n);
+}
+
+
+int posix_memalign (void **p, size_t a, size_t n)
+{
+    if (Rtscope::_depth) violation (RC_MALLOC);
+    *p = __libc_memalign (a, n);
+    return *p ? 0 : ENOMEM;
+}
+
+
+void free (void *p)
+{
+    if (p && Rtscope::_depth) violation (RC_FREE);
+    __libc_free (p);
+}
+
+
+int pthread_mutex_lock (pthread_mutex_t *m)
+{
+    if (Rtscope::_depth) violation (RC_MUTEX);
+    if (!real_mutex_lock)
+    {
+        real_mutex_lock = (int (*)(pthread_mutex_t *)) dlsym (RTLD_NEXT, "pthread_mutex_lock");
+    }
+    return real_mutex_lock (m);
+}
+
+
+ssize_t write (int fd, const void *p, size_t n)
+{
+    if (Rtscope::_depth) violation (RC_WRITE);
+    if (!real_write)
+    {
+        real_write = (ssize_t (*)(int, const void *, size_t)) dlsym (RTLD_NEXT, "write");
+    }
+    return real_write (fd, p, n);
+}
+
+}
+
+
+#endif
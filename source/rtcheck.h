@@ -0,0 +1,70 @@
+// ----------------------------------------------------------------------------
+//
+//  Copyright (C) 2010-2024 Fons Adriaensen <fons@linuxaudio.org>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// ----------------------------------------------------------------------------
+
+
+#ifndef __RTCHECK_H
+#define __RTCHECK_H
+
+
+// Debug aid, enabled by building with 'make RTCHECK=1'.
+// Code running inside an Rtscope must not allocate, lock
+// a mutex or write to a file descriptor. Calls to malloc,
+// free, pthread_mutex_lock and write made there are counted
+// and reported with a backtrace. If the environment variable
+// ZITA_RTCHECK is set to 'abort' the first one aborts the
+// program instead. Without RTCHECK all of this is a no-op.
+
+
+#ifdef RTCHECK
+
+
+class Rtscope
+{
+public:
+
+    Rtscope (void) { _depth++; }
+    ~Rtscope (void) { _depth--; }
+
+    static thread_local int _depth;
+};
+
+
+extern void rtcheck_init (void);
+extern void rtcheck_report (void);
+extern unsigned int rtcheck_count (void);
+
+
+#else
+
+
+class Rtscope
+{
+public:
+
+    Rtscope (void) {}
+};
+
+
+inline void rtcheck_init (void) {}
+inline void rtcheck_report (void) {}
+inline unsigned int rtcheck_count (void) { return 0; }
+
+
+#endif
+#endif
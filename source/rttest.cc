@@ -0,0 +1,273 @@
+// ----------------------------------------------------------------------------
+//
+//  Copyright (C) 2010-2024 Fons Adriaensen <fons@linuxaudio.org>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// ----------------------------------------------------------------------------
+
+
+// Driver for 'make RTCHECK=1 rtcheck'. Runs a Jclient on a
+// JACK server, fed by a second client providing audio and
+// MIDI, and goes through parameter changes from the main
+// and OSC sources, low latency toggles, note mask and MIDI
+// note and CC changes, and period size changes, each one
+// replacing the Retuners, also two in quick succession.
+// The exit status is non-zero if any call counted by
+// rtcheck.cc was made in the process callback or the
+// worker jobs.
+//
+// Usage: zita-at1-rttest [nchan [nwork [simd [pipe]]]]
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <atomic>
+#include <jack/jack.h>
+#include <jack/midiport.h>
+#include "jclient.h"
+#include "rtcheck.h"
+#include "global.h"
+
+
+// Provides the main loop timer, as the Headless does.
+
+class Driver : public A_thread
+{
+public:
+
+    Driver (void) : A_thread ("Main") {}
+
+    virtual void thr_main (void) {}
+};
+
+
+static Jclient       *jclient;
+static Driver        *driver;
+static jack_client_t *src_client;
+static jack_port_t   *src_aout;
+static jack_port_t   *src_mout;
+static std::atomic<bool> src_midi (false);
+static std::atomic<int>  src_notes (0);
+static float          src_fsamp = 48000;
+static float          src_phase = 0;
+static int            src_count = 0;
+
+
+static int src_process (jack_nframes_t nframes, void *arg)
+{
+    int            i, k;
+    float          *p;
+    void           *m;
+    unsigned char  *e;
+
+    // A 220 Hz tone with a slow vibrato, so there are pitch
+    // estimates, jumps and crossfades.
+    p = (float *) jack_port_get_buffer (src_aout, nframes);
+    for (i = 0; i < (int) nframes; i++)
+    {
+        p [i] = 0.3f * sinf (src_phase);
+        src_phase += 2 * M_PI * 220 * (1 + 0.03f * sinf (1e-4f * src_count * nframes)) / src_fsamp;
+        if (src_phase > 2 * M_PI) src_phase -= 2 * M_PI;
+    }
+    // Once enabled, a note change and a controller in every
+    // period, the controllers as mapped in main ().
+    m = jack_port_get_buffer (src_mout, nframes);
+    jack_midi_clear_buffer (m);
+    k = src_count++;
+    if (src_midi.load ())
+    {
+        if ((e = jack_midi_event_reserve (m, 0, 3)))
+        {
+            e [0] = 0x80;
+            e [1] = 60 + (k + 11) % 12;
+            e [2] = 0;
+        }
+        if ((e = jack_midi_event_reserve (m, nframes / 4, 3)))
+        {
+            e [0] = 0xB0;
+            e [1] = 20 + k % (Jclient::NPARAM + 1);
+            e [2] = (13 * k) & 127;
+        }
+        if ((e = jack_midi_event_reserve (m, nframes / 2, 3)))
+        {
+            e [0] = 0x90;
+            e [1] = 60 + k % 12;
+            e [2] = 64;
+        }
+        src_notes++;
+    }
+    return 0;
+}
+
+
+static int src_open (void)
+{
+    int   c;
+    char  s [256];
+
+    src_client = jack_client_open ("zita-at1-rttest", JackNoStartServer, 0);
+    if (! src_client) return 1;
+    src_fsamp = jack_get_sample_rate (src_client);
+    src_aout = jack_port_register (src_client, "out", JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
+    src_mout = jack_port_register (src_client, "midi", JACK_DEFAULT_MIDI_TYPE, JackPortIsOutput, 0);
+    jack_set_process_callback (src_client, src_process, 0);
+    if (jack_activate (src_client)) return 1;
+    for (c = 0; c < jclient->nchan (); c++)
+    {
+        if (jclient->nchan () > 1) snprintf (s, 256, "%s:in_%d", jclient->jname (), c + 1);
+        else snprintf (s, 256, "%s:in", jclient->jname ());
+        if (jack_connect (src_client, jack_port_name (src_aout), s)) return 1;
+    }
+    snprintf (s, 256, "%s:pitch", jclient->jname ());
+    return jack_connect (src_client, jack_port_name (src_mout), s);
+}
+
+
+static void run (int ms)
+{
+    int ev;
+
+    // Main loop as in zita-at1.cc, for 'ms' milliseconds.
+    for (ms /= 50; ms > 0; ms--)
+    {
+        driver->inc_time (50000);
+        do
+        {
+            ev = driver->get_event_timed ();
+            if (ev == EV_EXIT)
+            {
+                fprintf (stderr, "JACK has gone away.\n");
+                exit (1);
+            }
+            if ((ev == EV_RECONF) || (ev == Esync::EV_TIME)) jclient->reconfig ();
+        }
+        while (ev != Esync::EV_TIME);
+    }
+}
+
+
+static int resize (int fsize)
+{
+    if (jack_set_buffer_size (src_client, fsize))
+    {
+        fprintf (stderr, "Can't set the period size to %d.\n", fsize);
+        return 1;
+    }
+    // Enough for the 100 ms overlap and the deletion.
+    run (1000);
+    return 0;
+}
+
+
+int main (int ac, char *av [])
+{
+    int   c, i, k, m, nc, nw, fsize;
+    bool  simd, pipe;
+
+    static const int masks [4] = { 0xFFF, 0xAB5, 0x091, 0x001 };
+
+    rtcheck_init ();
+    nc = (ac > 1) ? atoi (av [1]) : 2;
+    nw = (ac > 2) ? atoi (av [2]) : 1;
+    simd = (ac > 3) ? atoi (av [3]) != 0 : true;
+    pipe = (ac > 4) ? atoi (av [4]) != 0 : false;
+    jclient = new Jclient ("zita-at1", 0, nc, nw, pipe, simd, false, true, true);
+    nc = jclient->nchan ();
+    driver = new Driver ();
+    ITC_ctrl::connect (jclient, EV_EXIT, driver, EV_EXIT);
+    ITC_ctrl::connect (jclient, EV_RECONF, driver, EV_RECONF);
+    driver->set_time (0);
+    jclient->set_timing (true);
+    jclient->set_jumpplan (true);
+    if (src_open ())
+    {
+        fprintf (stderr, "Can't set up the source client.\n");
+        return 1;
+    }
+    fsize = jack_get_buffer_size (src_client);
+    run (500);
+
+    printf ("Parameters...\n");
+    for (i = 0; i < 40; i++)
+    {
+        c = i % nc;
+        k = i % Jclient::NPARAM;
+        jclient->set_param (Jclient::SRC_MAIN, c, k, (i & 1) ? 1e3f : -1e3f);
+        jclient->set_param (Jclient::SRC_OSC, (i / 2) % nc, (k + 2) % Jclient::NPARAM, 0.01f * i);
+        run (50);
+    }
+
+    printf ("Low latency...\n");
+    for (i = 0; i < 8; i++)
+    {
+        jclient->set_lowlat (i % nc, i & 1);
+        jclient->set_param (Jclient::SRC_OSC, (i + 1) % nc, Jclient::P_LLAT, i & 2);
+        run (100);
+    }
+
+    printf ("Note masks...\n");
+    for (i = 0; i < 8; i++)
+    {
+        jclient->set_notemask (i % nc, masks [i & 3]);
+        jclient->set_param (Jclient::SRC_OSC, (i + 1) % nc, Jclient::P_MASK, masks [(i + 2) & 3] | 0x7000);
+        run (100);
+    }
+
+    printf ("MIDI notes and controllers...\n");
+    for (k = 0; k < Jclient::NPARAM; k++) jclient->set_ccmap (20 + k, k, -1);
+    jclient->set_ccmap (20 + Jclient::NPARAM, Jclient::P_TUNE, nc - 1);
+    jclient->set_midichan (-1);
+    src_midi = true;
+    m = 0;
+    for (i = 0; i < 20; i++)
+    {
+        run (50);
+        m |= jclient->get_midiset ();
+    }
+    // The source uses channel 1, these should be ignored.
+    jclient->set_midichan (1);
+    jclient->clr_midimask ();
+    run (500);
+    src_midi = false;
+    jclient->set_midichan (-1);
+    jclient->clr_midimask ();
+    if (! m || ! src_notes || ! jclient->get_ccount ())
+    {
+        fprintf (stderr, "No MIDI notes or controllers received.\n");
+        return 1;
+    }
+
+    printf ("Period size changes...\n");
+    if (resize (fsize / 2) || resize (fsize)) return 1;
+    // Growing past all previous sizes twice in a row, the
+    // second change cancels the pending swap.
+    if (jack_set_buffer_size (src_client, 2 * fsize) || resize (4 * fsize) || resize (fsize)) return 1;
+    run (500);
+
+    jack_deactivate (src_client);
+    jack_client_close (src_client);
+    delete jclient;
+    delete driver;
+    rtcheck_report ();
+    if (rtcheck_count ())
+    {
+        printf ("FAILED\n");
+        return 1;
+    }
+    printf ("PASSED\n");
+    return 0;
+}
@@ -0,0 +1,156 @@
+// ----------------------------------------------------------------------------
+//
+//  Copyright (C) 2010-2024 Fons Adriaensen <fons@linuxaudio.org>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// ----------------------------------------------------------------------------
+
+
+#include <fstream>
+#include <iostream>
+#include <stdlib.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <string.h>
+#include "state.h"
+
+
+using namespace std;
+
+
+// Parameter names in the state file, in the order of the
+// Jclient enum.
+static const char *parname [Jclient::NPARAM] = { "tune", "filt", "bias", "corr", "offs" };
+static const float pardef [Jclient::NPARAM] = { 440.0f, 0.1f, 0.5f, 1.0f, 0.0f };
+
+
+bool state_load (const char *file, Jclient *jclient, int *xp, int *yp, bool *shown)
+{
+    ifstream statefile (file);
+
+    // Parameters are '/autotune/<name>' for all channels, or
+    // '/autotune/<channel>/<name>' for a single one.
+
+    if (! statefile.is_open ()) return false;
+
+    string parameter;
+    string name;
+    float  v;
+    int    c, c0, c1, k;
+    int    notes;
+
+    while (!statefile.eof())
+    {
+        statefile >> parameter;
+        if (parameter == "/window/x")
+        {
+            statefile >> dec >> *xp;
+        }
+        else if (parameter == "/window/y")
+        {
+            statefile >> dec >> *yp;
+        }
+        else if (parameter == "/window/shown")
+        {
+            statefile >> dec >> k;
+            *shown = k != 0;
+        }
+        else if (parameter.compare (0, 8, "/midicc/") == 0)
+        {
+            // '/midicc/<controller> <name> <channel>',
+            // channel 0 for all.
+            statefile >> name >> dec >> c;
+            for (k = 0; k < Jclient::NPARAM; k++) if (name == parname [k]) break;
+            if ((k < Jclient::NPARAM) && (c >= 0) && (c <= jclient->nchan ()))
+            {
+                jclient->set_ccmap (atoi (parameter.c_str () + 8), k, c - 1);
+            }
+        }
+        else if (parameter.compare (0, 10, "/autotune/") == 0)
+        {
+            name = parameter.substr (10);
+            c0 = 0;
+            c1 = jclient->nchan ();
+            if (isdigit (name [0]))
+            {
+                c0 = atoi (name.c_str ()) - 1;
+                c1 = c0 + 1;
+                name = name.substr (name.find ('/') + 1);
+                if ((c0 < 0) || (c1 > jclient->nchan ())) c0 = c1;
+            }
+            if (name == "notes")
+            {
+                statefile >> hex >> notes;
+                for (c = c0; c < c1; c++) jclient->set_notemask (c, notes & 0xFFF);
+                continue;
+            }
+            for (k = 0; k < Jclient::NPARAM; k++) if (name == parname [k]) break;
+            if (k == Jclient::NPARAM) continue;
+            statefile >> dec >> v;
+            // Limited to the range of the controls by set_param ().
+            for (c = c0; c < c1; c++) jclient->set_param (Jclient::SRC_MAIN, c, k, v);
+        }
+    }
+    statefile.close ();
+    return true;
+}
+
+
+void state_reset (Jclient *jclient)
+{
+    int c, k;
+
+    for (c = 0; c < jclient->nchan (); c++)
+    {
+        for (k = 0; k < Jclient::NPARAM; k++) jclient->set_param (Jclient::SRC_MAIN, c, k, pardef [k]);
+        jclient->set_notemask (c, 0xFFF);
+        jclient->set_lowlat (c, false);
+    }
+    for (c = 0; c < 128; c++) jclient->set_ccmap (c, -1, -1);
+}
+
+
+bool state_save (const char *file, Jclient *jclient, int xp, int yp, bool shown)
+{
+    ofstream statefile (file);
+
+    if (! statefile.is_open ()) return false;
+
+    char s [32];
+    int  c, i, k;
+
+    for (c = 0; c < jclient->nchan (); c++)
+    {
+        if (jclient->nchan () > 1) sprintf (s, "/autotune/%d/", c + 1);
+        else strcpy (s, "/autotune/");
+        statefile << s << "tune\t"  << dec << jclient->get_refpitch (c) << endl;
+        statefile << s << "bias\t"  << dec << jclient->get_notebias (c) << endl;
+        statefile << s << "filt\t"  << dec << jclient->get_corrfilt (c) << endl;
+        statefile << s << "corr\t"  << dec << jclient->get_corrgain (c) << endl;
+        statefile << s << "offs\t"  << dec << jclient->get_corroffs (c) << endl;
+        statefile << s << "notes\t" << hex << jclient->get_notemask (c) << endl;
+    }
+    for (c = 0; c < 128; c++)
+    {
+        k = jclient->get_ccmap (c, &i);
+        if (k < 0) continue;
+        statefile << "/midicc/" << dec << c << "\t" << parname [k] << " " << i + 1 << endl;
+    }
+    statefile << "/window/x\t" << dec << xp << endl;
+    statefile << "/window/y\t" << dec << yp << endl;
+    statefile << "/window/shown\t" << dec << (shown ? 1 : 0) << endl;
+    statefile.close ();
+    return true;
+}
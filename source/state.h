@@ -0,0 +1,43 @@
+// ----------------------------------------------------------------------------
+//
+//  Copyright (C) 2010-2024 Fons Adriaensen <fons@linuxaudio.org>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// ----------------------------------------------------------------------------
+
+
+#ifndef __STATE_H
+#define __STATE_H
+
+
+#include "jclient.h"
+
+
+// The state file, used by both the GUI and headless modes.
+// state_load () sets the parameters and MIDI CC map found in
+// 'file', and the window position and visibility if present.
+// It returns false if the file can't be read. state_save ()
+// writes all of them.
+
+extern bool state_load (const char *file, Jclient *jclient, int *xp, int *yp, bool *shown);
+extern bool state_save (const char *file, Jclient *jclient, int xp, int yp, bool shown);
+
+// Sets the parameters of all channels to their defaults and
+// clears the MIDI CC map, before loading another state.
+
+extern void state_reset (Jclient *jclient);
+
+
+#endif
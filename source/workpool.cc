@@ -0,0 +1,182 @@
+// ----------------------------------------------------------------------------
+//
+//  Copyright (C) 2010-2024 Fons Adriaensen <fons@linuxaudio.org>
+//    
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// ----------------------------------------------------------------------------
+
+
+#include <stdio.h>
+#include <sched.h>
+#include <pthread.h>
+#include "workpool.h"
+
+
+void Worker::thr_main (void)
+{
+    cpu_set_t  cpus;
+
+    if (_cpu >= 0)
+    {
+        CPU_ZERO (&cpus);
+        CPU_SET (_cpu, &cpus);
+        if (pthread_setaffinity_np (pthread_self (), sizeof (cpus), &cpus))
+        {
+            fprintf (stderr, "Warning: can't set affinity of worker %d.\n", _index);
+        }
+    }
+    while (true)
+    {
+        _trig.wait ();
+        if (_pool->_stop) break;
+        _pool->work (_index);
+        _pool->_busy.fetch_sub (1, std::memory_order_release);
+    }
+    _pool->_busy.fetch_sub (1, std::memory_order_release);
+}
+
+
+Workpool::Workpool (void) :
+    _nthr (0),
+    _stop (false),
+    _func (0),
+    _arg (0),
+    _busy (0)
+{
+}
+
+
+Workpool::~Workpool (void)
+{
+    stop ();
+}
+
+
+int Workpool::start (int nthr, int prio, Jobfunc func, void *arg)
+{
+    int  i, n, p;
+
+    // The calling (JACK process) thread also takes jobs, so
+    // there are nthr + 1 job ranges. Workers are pinned to
+    // consecutive CPUs, leaving the first one to the caller.
+    // 'prio' is the absolute RT priority, as returned by
+    // jack_client_real_time_priority(), or < 0 for none.
+
+    if (nthr > MAXTHR) nthr = MAXTHR;
+    n = sysconf (_SC_NPROCESSORS_ONLN);
+    _func = func;
+    _arg = arg;
+    _stop = false;
+    if (prio > 0)
+    {
+        p = SCHED_FIFO;
+        prio -= sched_get_priority_max (SCHED_FIFO);
+    }
+    else
+    {
+        p = SCHED_OTHER;
+        prio = 0;
+    }
+    for (i = 0; i < nthr; i++)
+    {
+        _workers [i]._pool = this;
+        _workers [i]._index = i + 1;
+        _workers [i]._cpu = (n > 1) ? (i + 1) % n : -1;
+        if (_workers [i].thr_start (p, prio, 0x10000))
+        {
+            fprintf (stderr, "Warning: can't start worker thread %d.\n", i + 1);
+            break;
+        }
+        _nthr++;
+    }
+    return _nthr;
+}
+
+
+void Workpool::stop (void)
+{
+    int i;
+
+    if (!_nthr) return;
+    join ();
+    _stop = true;
+    _busy.store (_nthr);
+    for (i = 0; i < _nthr; i++) _workers [i]._trig.post ();
+    while (_busy.load (std::memory_order_acquire)) usleep (1000);
+    _nthr = 0;
+}
+
+
+void Workpool::run (int njobs)
+{
+    fork (njobs, true);
+    work (0);
+    join ();
+}
+
+
+void Workpool::fork (int njobs, bool self)
+{
+    int  i, n, k;
+
+    // Split the jobs in contiguous ranges, one per thread,
+    // so each job normally stays on the same core. Range 0
+    // belongs to the caller, and is empty if it is not going
+    // to take part. In that case fork() returns immediately
+    // and a later join() waits for the jobs.
+
+    n = _nthr + 1;
+    _range [0].head.store (0, std::memory_order_relaxed);
+    _range [0].end = 0;
+    for (i = self ? 0 : 1, k = 0; i < n; i++)
+    {
+        _range [i].head.store (k, std::memory_order_relaxed);
+        k += (njobs - k) / (n - i);
+        _range [i].end = k;
+    }
+    _busy.store (_nthr, std::memory_order_release);
+    for (i = 0; i < _nthr; i++) _workers [i]._trig.post ();
+}
+
+
+void Workpool::join (void)
+{
+    // Spin until all workers are done. After run() this is
+    // never longer than one job.
+
+    while (_busy.load (std::memory_order_acquire))
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause ();
+#endif
+    }
+}
+
+
+void Workpool::work (int k)
+{
+    int  i, j, n;
+
+    // Own range first, then steal from the others.
+    n = _nthr + 1;
+    for (i = 0; i < n; i++)
+    {
+        Range *R = _range + (k + i) % n;
+        while ((j = R->head.fetch_add (1, std::memory_order_relaxed)) < R->end)
+        {
+            _func (_arg, j);
+        }
+    }
+}
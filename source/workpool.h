@@ -0,0 +1,93 @@
+// ----------------------------------------------------------------------------
+//
+//  Copyright (C) 2010-2024 Fons Adriaensen <fons@linuxaudio.org>
+//    
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// ----------------------------------------------------------------------------
+
+
+#ifndef __WORKPOOL_H
+#define __WORKPOOL_H
+
+
+#include <atomic>
+#include <clthreads.h>
+
+
+class Workpool;
+
+
+class Worker : public P_thread
+{
+public:
+
+    Worker (void) : _pool (0), _index (0), _cpu (-1) {}
+
+private:
+
+    friend class Workpool;
+
+    virtual void thr_main (void);
+
+    Workpool       *_pool;
+    int             _index;
+    int             _cpu;
+    P_sema          _trig;
+};
+
+
+class Workpool
+{
+public:
+
+    enum { MAXTHR = 32 };
+
+    typedef void (*Jobfunc)(void *arg, int job);
+
+    Workpool (void);
+    ~Workpool (void);
+
+    int  start (int nthr, int prio, Jobfunc func, void *arg);
+    void stop (void);
+    void run (int njobs);
+    void fork (int njobs, bool self);
+    void join (void);
+    int  nthr (void) const { return _nthr; }
+
+private:
+
+    friend class Worker;
+
+    // Job range owned by a thread. Claims are made by atomic
+    // increment of 'head', by the owner or by a thief.
+    struct Range
+    {
+        alignas (64) std::atomic<int> head;
+        int  end;
+    };
+
+    void work (int k);
+
+    int                _nthr;
+    bool               _stop;
+    Jobfunc            _func;
+    void              *_arg;
+    Worker             _workers [MAXTHR];
+    Range              _range [MAXTHR + 1];
+    alignas (64) std::atomic<int> _busy;
+};
+
+
+#endif
@@ -20,6 +20,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <clthreads.h>
 #include <sys/mman.h>
 #include <signal.h>
@@ -28,9 +29,14 @@
 #include "jclient.h"
 #include "mainwin.h"
 #include "nsm.h"
+#include "oscserver.h"
+#include "headless.h"
+#include "state.h"
+#include "rtcheck.h"
 
 
-#define NOPTS 3
+#define NOPTS 24
+#define NSMWAIT 10000
 #define CP (char *)
 
 
@@ -38,13 +44,36 @@ XrmOptionDescRec options [NOPTS] =
 {
     {CP"-h",    CP".help",      XrmoptionNoArg,   CP"true" },
     {CP"-g",    CP".geometry",  XrmoptionSepArg,  0        },
-    {CP"-s",    CP".server",    XrmoptionSepArg,  0        }
+    {CP"-s",    CP".server",    XrmoptionSepArg,  0        },
+    {CP"-j",    CP".jumpplan",  XrmoptionNoArg,   CP"true" },
+    {CP"-c",    CP".channels",  XrmoptionSepArg,  0        },
+    {CP"-w",    CP".workers",   XrmoptionSepArg,  0        },
+    {CP"-p",    CP".pipeline",  XrmoptionNoArg,   CP"true" },
+    {CP"-v",    CP".simd",      XrmoptionNoArg,   CP"true" },
+    {CP"-t",    CP".stagger",   XrmoptionNoArg,   CP"true" },
+    {CP"-k",    CP".costhist",  XrmoptionNoArg,   CP"true" },
+    {CP"-m",    CP".midiout",   XrmoptionNoArg,   CP"true" },
+    {CP"-o",    CP".ctlout",    XrmoptionNoArg,   CP"true" },
+    {CP"-T",    CP".telemetry", XrmoptionNoArg,   CP"true" },
+    {CP"-D",    CP".dumpfile",  XrmoptionSepArg,  0        },
+    {CP"-O",    CP".oscport",   XrmoptionSepArg,  0        },
+    {CP"-n",    CP".headless",  XrmoptionNoArg,   CP"true" },
+    {CP"-f",    CP".statefile", XrmoptionSepArg,  0        },
+    {CP"-tune", CP".tune",      XrmoptionSepArg,  0        },
+    {CP"-filt", CP".filt",      XrmoptionSepArg,  0        },
+    {CP"-bias", CP".bias",      XrmoptionSepArg,  0        },
+    {CP"-corr", CP".corr",      XrmoptionSepArg,  0        },
+    {CP"-offs", CP".offs",      XrmoptionSepArg,  0        },
+    {CP"-notes",CP".notes",     XrmoptionSepArg,  0        },
+    {CP"-llat", CP".lowlat",    XrmoptionNoArg,   CP"true" }
 };
 
 
 
-static Jclient  *jclient = 0;
+Jclient  *jclient = 0;
+static Oscserver *oscserver = 0;
 Mainwin  *mainwin = 0;
+Headless *headless = 0;
 NSM_Client *nsm = 0;
 
 
@@ -57,14 +86,111 @@ static void help (void)
     fprintf (stderr, "  -name <name>    Jack client name\n");
     fprintf (stderr, "  -s <server>     Jack server name\n");
     fprintf (stderr, "  -g <geometry>   Window position\n");
+    fprintf (stderr, "  -j              Correlation based jump planning\n");
+    fprintf (stderr, "  -c <channels>   Number of channels [1]\n");
+    fprintf (stderr, "  -w <threads>    Worker threads for multichannel [0]\n");
+    fprintf (stderr, "  -p              Pipelined processing, adds one period latency\n");
+    fprintf (stderr, "  -v              Process channels in SIMD groups of %d\n", Retbank::NLANE);
+    fprintf (stderr, "  -t              Stagger pitch analysis of channels and instances\n");
+    fprintf (stderr, "  -k              Print histogram of callback time at exit\n");
+    fprintf (stderr, "  -m              MIDI output of detected pitch\n");
+    fprintf (stderr, "  -o              Frequency, error and ratio outputs\n");
+    fprintf (stderr, "  -T              Print DSP load and timing every second\n");
+    fprintf (stderr, "  -D <file>       Append DSP load and timing to file\n");
+    fprintf (stderr, "  -O <port>       OSC control and analysis on UDP port\n");
+    fprintf (stderr, "  -n              Headless, no GUI or display needed\n");
+    fprintf (stderr, "  -f <file>       Read parameters from state file\n");
+    fprintf (stderr, "Initial parameters, for all channels:\n");
+    fprintf (stderr, "  -tune <Hz>      Reference pitch [440]\n");
+    fprintf (stderr, "  -filt <s>       Correction filter [0.1]\n");
+    fprintf (stderr, "  -bias <v>       Note bias [0.5]\n");
+    fprintf (stderr, "  -corr <v>       Correction amount [1.0]\n");
+    fprintf (stderr, "  -offs <v>       Offset in semitones [0.0]\n");
+    fprintf (stderr, "  -notes <hex>    Note mask [fff]\n");
+    fprintf (stderr, "  -llat           Low latency\n");
     exit (1);
 }
 
 
+static void costhist (void)
+{
+    int           i;
+    unsigned int  h [Jclient::COSTBINS], n;
+
+    jclient->get_costhist (h);
+    for (i = n = 0; i < Jclient::COSTBINS; i++) n += h [i];
+    if (! n) return;
+    printf ("Callback time, %% of period:\n");
+    for (i = 0; i < Jclient::COSTBINS; i++)
+    {
+        if (! h [i]) continue;
+        if (i < Jclient::COSTBINS - 1) printf ("  %3d..%3d  ", 5 * i, 5 * i + 5);
+        else printf ("  %3d..     ", 5 * i);
+        printf ("%8u  %6.2lf%%\n", h [i], 100.0 * h [i] / n);
+    }
+}
+
+
+static void telemetry (FILE *F, bool pr)
+{
+    Jclient::Jstats  S;
+
+    // Called once per second. Timing is shown in us, the
+    // phase times are mean values per period.
+    if (! jclient->get_stats (&S)) return;
+    if (mainwin) mainwin->show_stats (&S);
+    if (pr)
+    {
+        printf ("DSP %5.1f%%  xruns %u  callback %.1f %.1f %.1f %.1f  resamp %.1f  interp %.1f  analyse %.1f  jumps %.1f/s\n",
+                S.cpuload, S.xruns, 1e-3f * S.tmin, 1e-3f * S.tmean, 1e-3f * S.tp99, 1e-3f * S.tmax,
+                1e-3f * S.phase [Retuner::PH_RESAMP], 1e-3f * S.phase [Retuner::PH_INTERP],
+                1e-3f * S.phase [Retuner::PH_ANALYSE], S.jumps);
+        fflush (stdout);
+    }
+    if (F)
+    {
+        // One line per interval, times in ns.
+        fprintf (F, "%ld %u %u %.2f %.0f %.0f %.0f %.0f %.0f %.0f %.0f %.2f %.0f\n",
+                 (long) time (0), S.periods, S.xruns, S.cpuload, S.tmin, S.tmean, S.tp99, S.tmax,
+                 S.phase [Retuner::PH_RESAMP], S.phase [Retuner::PH_INTERP],
+                 S.phase [Retuner::PH_ANALYSE], S.jumps, S.xfade);
+        fflush (F);
+    }
+}
+
+
+static void setparams (X_resman *xres)
+{
+    int          c, k;
+    const char  *p;
+
+    // Initial values from the command line, overruled by
+    // those in a state file.
+    static const char *parres [Jclient::NPARAM] = { ".tune", ".filt", ".bias", ".corr", ".offs" };
+
+    for (k = 0; k < Jclient::NPARAM; k++)
+    {
+        p = xres->get (parres [k], 0);
+        if (! p) continue;
+        for (c = 0; c < jclient->nchan (); c++) jclient->set_param (Jclient::SRC_MAIN, c, k, atof (p));
+    }
+    p = xres->get (".notes", 0);
+    if (p)
+    {
+        for (c = 0; c < jclient->nchan (); c++) jclient->set_notemask (c, strtol (p, 0, 16));
+    }
+    if (xres->getb (".lowlat", 0))
+    {
+        for (c = 0; c < jclient->nchan (); c++) jclient->set_lowlat (c, true);
+    }
+}
+
+
 static void sigint_handler (int)
 {
     signal (SIGINT, SIG_IGN);
-    mainwin->stop ();
+    if (mainwin) mainwin->stop ();
+    else headless->stop ();
 }
 
 
@@ -74,37 +200,41 @@ int main (int ac, char *av [])
     X_display     *display;
     X_handler     *handler;
     X_rootwin     *rootwin;
-    int           ev, xp, yp, xs, ys;
+    int           i, ev, xp, yp, xs, ys, nc;
+    long long     t, tt;
+    bool          hl, pr;
+    const char    *p;
+    FILE          *F;
     char          *nsm_url;
     string        program_name = PROGNAME;
     string        state_file ="";
     bool          managed = false;
 
+    rtcheck_init ();
     nsm_url = getenv("NSM_URL");
 
     if (nsm_url)
     {
         nsm = new NSM_Client;
-        if (!nsm->init(nsm_url))
+        if (!nsm->init_thread(nsm_url))
+        {
+            nsm->start ();
+            // The GUI is optional, unless there is none.
+            for (i = 1; (i < ac) && strcmp (av [i], "-n"); i++);
+            nsm->announce(program_name.c_str(), (i < ac) ? ":dirty:switch:" : ":dirty:switch:optional-gui:", av[0]);
+            // Sleep until the server has answered and sent the
+            // first open, or give up and run unmanaged.
+            managed = nsm->wait_open (NSMWAIT);
+        }
+        if (managed)
         {
-            nsm->announce(program_name.c_str(), ":dirty:", av[0]);
-            do
-            {
-                nsm->check ();
-                usleep(10);
-                managed = nsm->is_active();
-            } while (!nsm->is_active());
-            do
-            {
-                nsm->check ();
-                usleep(10);
-            } while (!nsm->client_id());
             program_name = nsm->client_id ();
             state_file = nsm->client_path ();
             state_file += ".conf";
         }
         else
         {
+            fprintf (stderr, "No session manager, running unmanaged.\n");
             delete nsm;
             nsm = NULL;
         }
@@ -112,43 +242,117 @@ int main (int ac, char *av [])
 
     xresman.init (&ac, av, CP program_name.c_str(), options, NOPTS);
     if (xresman.getb (".help", 0)) help ();
-            
-    display = new X_display (xresman.get (".display", 0));
-    if (display->dpy () == 0)
+    hl = xresman.getb (".headless", 0);
+
+    display = 0;
+    if (! hl)
     {
-        fprintf (stderr, "Can't open display.\n");
-        delete display;
-        return 1;
+        display = new X_display (xresman.get (".display", 0));
+        if (display->dpy () == 0)
+        {
+            fprintf (stderr, "Can't open display.\n");
+            delete display;
+            return 1;
+        }
     }
 
-    xp = yp = 100;
-    xs = Mainwin::XSIZE + 4;
-    ys = Mainwin::YSIZE + 30;
-    xresman.geometry (".geometry", display->xsize (), display->ysize (), 1, xp, yp, xs, ys);
-
-    styles_init (display, &xresman);
-    jclient = new Jclient (xresman.rname (), xresman.get (".server", 0));
-    rootwin = new X_rootwin (display);
-    mainwin = new Mainwin (rootwin, &xresman, xp, yp, jclient);
-    rootwin->handle_event ();
-    handler = new X_handler (display, mainwin, EV_X11);
-    handler->next_event ();
-    XFlush (display->dpy ());
-    ITC_ctrl::connect (jclient, EV_EXIT, mainwin, EV_EXIT);
+    nc = atoi (xresman.get (".channels", "1"));
+    if (nc < 1) nc = 1;
+    if (nc > Jclient::MAXCHAN) nc = Jclient::MAXCHAN;
 
+    xp = yp = 100;
+    if (display)
+    {
+        xs = Mainwin::XSIZE + 4;
+        if (nc > 1) xs += Mainwin::XCHAN;
+        ys = Mainwin::YSIZE + 30;
+        xresman.geometry (".geometry", display->xsize (), display->ysize (), 1, xp, yp, xs, ys);
+        styles_init (display, &xresman);
+    }
+    // Lock memory before the Jclient allocates and prewarms its buffers.
     if (mlockall (MCL_CURRENT | MCL_FUTURE)) fprintf (stderr, "Warning: memory lock failed.\n");
-    signal (SIGINT, sigint_handler); 
+    jclient = new Jclient (xresman.rname (), xresman.get (".server", 0), nc,
+                           atoi (xresman.get (".workers", "0")),
+                           xresman.getb (".pipeline", 0),
+                           xresman.getb (".simd", 0),
+                           xresman.getb (".stagger", 0),
+                           xresman.getb (".midiout", 0),
+                           xresman.getb (".ctlout", 0));
+    jclient->set_jumpplan (xresman.getb (".jumpplan", 0));
+    setparams (&xresman);
+    pr = xresman.getb (".telemetry", 0);
+    F = 0;
+    p = xresman.get (".dumpfile", 0);
+    if (p)
+    {
+        F = fopen (p, "a");
+        if (F) fprintf (F, "# time periods xruns cpuload tmin tmean tp99 tmax resamp interp analyse jumps xfade\n");
+        else fprintf (stderr, "Can't open '%s'.\n", p);
+    }
+    // The phase times are also shown by the GUI.
+    jclient->set_timing (pr || F || display);
+    p = xresman.get (".oscport", 0);
+    if (p)
+    {
+        oscserver = new Oscserver (jclient);
+        if (oscserver->start (p))
+        {
+            fprintf (stderr, "Can't start OSC server on port %s.\n", p);
+            delete oscserver;
+            oscserver = 0;
+        }
+    }
 
-    mainwin->set_managed (managed);
-    if (managed)
+    // Without NSM a state file can be given on the command
+    // line, it is then only read.
+    if (! managed)
     {
-        mainwin->set_statefile (state_file);
-        mainwin->load_state ();
+        p = xresman.get (".statefile", 0);
+        if (p) state_file = p;
     }
 
+    handler = 0;
+    rootwin = 0;
+    if (display)
+    {
+        rootwin = new X_rootwin (display);
+        mainwin = new Mainwin (rootwin, &xresman, xp, yp, jclient);
+        rootwin->handle_event ();
+        handler = new X_handler (display, mainwin, EV_X11);
+        handler->next_event ();
+        XFlush (display->dpy ());
+        ITC_ctrl::connect (jclient, EV_EXIT, mainwin, EV_EXIT);
+        ITC_ctrl::connect (jclient, EV_RECONF, mainwin, EV_RECONF);
+        ITC_ctrl::connect (jclient, EV_PARAM, mainwin, EV_PARAM);
+        mainwin->set_managed (managed);
+        mainwin->set_telemetry (pr || F);
+        if (state_file.size ())
+        {
+            mainwin->set_statefile (state_file);
+            mainwin->load_state ();
+        }
+        else mainwin->show_gui (true);
+    }
+    else
+    {
+        headless = new Headless (jclient);
+        ITC_ctrl::connect (jclient, EV_EXIT, headless, EV_EXIT);
+        ITC_ctrl::connect (jclient, EV_RECONF, headless, EV_RECONF);
+        if (state_file.size ())
+        {
+            headless->set_statefile (state_file);
+            headless->load_state ();
+        }
+    }
+
+    signal (SIGINT, sigint_handler); 
+    // NSM requests can be handled from now on.
+    if (nsm) nsm->set_target (mainwin ? (A_thread *) mainwin : (A_thread *) headless);
+
+    tt = nsec_time () + 1000000000LL;
     do
     {
-        ev = mainwin->process ();
+        ev = mainwin ? mainwin->process () : headless->process ();
         if (ev == EV_X11)
         {
             rootwin->handle_event ();
@@ -156,14 +360,33 @@ int main (int ac, char *av [])
         }
         if (ev == Esync::EV_TIME)
         {
-            rootwin->handle_event ();
+            if (rootwin) rootwin->handle_event ();
+            // The tick stops while the GUI is hidden, unless
+            // there is telemetry output.
+            t = nsec_time ();
+            if (t >= tt)
+            {
+                telemetry (F, pr);
+                tt = t + 1000000000LL;
+            }
+        }
+        if ((ev == EV_RECONF) || (ev == EV_PARAM) || (ev == EV_NSM) || (ev == Esync::EV_TIME))
+        {
+            // Also before an NSM request, so a save has the
+            // latest parameters.
+            jclient->reconfig ();
         }
-        if (nsm) nsm->check ();
+        if (ev == EV_NSM) nsm->handle_requests ();
     }
     while (ev != EV_EXIT);
 
-    styles_fini (display);
+    if (display) styles_fini (display);
+    if (xresman.getb (".costhist", 0)) costhist ();
+    if (F) fclose (F);
+    rtcheck_report ();
+    delete oscserver;
     delete jclient;
+    delete headless;
     delete handler;
     delete rootwin;
     delete display;